@@ -3,6 +3,7 @@
 #include <eosio/vm/constants.hpp>
 #include <eosio/vm/exceptions.hpp>
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
@@ -416,11 +417,65 @@ public:
 };
 
 class wasm_allocator {
+public:
+  // Dirty memory of at least this many bytes is released with madvise on
+  // reset rather than cleared with memset.
+  static constexpr std::size_t default_madvise_threshold = 16 * page_size;
+
 private:
   char *raw = nullptr;
   int32_t page = 0;
+  // High-water mark of the pages written since memory was last cleaned. The
+  // pages above it are still zero.
+  int32_t dirty_pages = 0;
+  // Pages mapped from a memory snapshot rather than anonymous memory.
+  int32_t snapshot_pages = 0;
+  std::size_t madvise_threshold = default_madvise_threshold;
+
+  // Zeroes all dirty pages. A snapshot mapping is replaced with fresh
+  // inaccessible anonymous memory, which leaves no pages accessible.
+  void clean() {
+    if (dirty_pages == 0)
+      return;
+    if (snapshot_pages) {
+      void *ptr = mmap(raw, page_size * dirty_pages, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+      EOS_VM_ASSERT(ptr != MAP_FAILED, wasm_bad_alloc, "mmap failed");
+      snapshot_pages = 0;
+      page = 0;
+    } else if (page_size * dirty_pages >= madvise_threshold) {
+      // The kernel maps zero pages back in on the next access.
+      int err = madvise(raw, page_size * dirty_pages, MADV_DONTNEED);
+      EOS_VM_ASSERT(err == 0, wasm_bad_alloc, "madvise failed");
+    } else {
+      memset(raw, '\0', page_size * page); // zero the memory
+      // Pages freed since they were written are no longer accessible.
+      if (dirty_pages > page) {
+        int err = madvise(raw + page_size * page,
+                          page_size * (dirty_pages - page), MADV_DONTNEED);
+        EOS_VM_ASSERT(err == 0, wasm_bad_alloc, "madvise failed");
+      }
+    }
+    dirty_pages = 0;
+  }
 
 public:
+  // Maps the first @pages pages of the file @fd copy-on-write as the linear
+  // memory. Requires an allocator that was reset to hold no pages.
+  void map_snapshot(int fd, uint32_t pages) {
+    EOS_VM_ASSERT(page == 0, wasm_bad_alloc, "memory is already in use");
+    EOS_VM_ASSERT(pages <= max_pages, wasm_bad_alloc,
+                  "wasm_allocator exceeded max number of pages");
+    if (pages == 0)
+      return;
+    void *ptr = mmap(raw, page_size * pages, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_FIXED, fd, 0);
+    EOS_VM_ASSERT(ptr != MAP_FAILED, wasm_bad_alloc, "mmap failed");
+    page = pages;
+    snapshot_pages = pages;
+    dirty_pages = std::max<int32_t>(dirty_pages, pages);
+  }
+  void set_madvise_threshold(std::size_t bytes) { madvise_threshold = bytes; }
   template <typename T> void alloc(size_t size = 1 /*in pages*/) {
     if (size == 0)
       return;
@@ -430,9 +485,14 @@ public:
     int err = mprotect(raw + (page_size * page), (page_size * size),
                        PROT_READ | PROT_WRITE);
     EOS_VM_ASSERT(err == 0, wasm_bad_alloc, "mprotect failed");
-    T *ptr = (T *)(raw + (page_size * page));
-    memset(ptr, 0, page_size * size);
+    // Only pages that were freed after being written need zeroing.
+    if (page < dirty_pages) {
+      T *ptr = (T *)(raw + (page_size * page));
+      memset(ptr, 0,
+             page_size * std::min<size_t>(size, dirty_pages - page));
+    }
     page += size;
+    dirty_pages = std::max(dirty_pages, page);
   }
   template <typename T> void free(std::size_t size) {
     if (size == 0)
@@ -460,7 +520,7 @@ public:
   }
   void reset(uint32_t new_pages) {
     if (page != -1) {
-      memset(raw, '\0', page_size * page); // zero the memory
+      clean();
     } else {
       std::size_t syspagesize =
           static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
@@ -480,7 +540,7 @@ public:
     if (page != -1) {
       std::size_t syspagesize =
           static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
-      memset(raw, '\0', page_size * page); // zero the memory
+      clean();
       int err = mprotect(raw - syspagesize, page_size * page + syspagesize,
                          PROT_NONE);
       EOS_VM_ASSERT(err == 0, wasm_bad_alloc, "mprotect failed");
@@ -5,7 +5,9 @@
 #include <eosio/vm/config.hpp>
 #include <eosio/vm/debug_visitor.hpp>
 #include <eosio/vm/execution_context.hpp>
+#include <eosio/vm/gas_metering.hpp>
 #include <eosio/vm/interpret_visitor.hpp>
+#include <eosio/vm/jit_image.hpp>
 #include <eosio/vm/parser.hpp>
 #include <eosio/vm/types.hpp>
 #include <eosio/vm/x86_64.hpp>
@@ -14,6 +16,7 @@
 #include <exception>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <optional>
 #include <string_view>
 #include <system_error>
@@ -22,11 +25,20 @@
 namespace eosio {
 namespace vm {
 
+// How the jit generates the code of a module.
+struct jit_options {
+  // Charged for each instruction against the gas counter, unless null.
+  const gas_costs *costs = nullptr;
+  // Poll the interrupt flag on function entry and at loop heads, which
+  // polled_run needs and other runs pay for without using.
+  bool interrupt_polls = false;
+};
+
 struct jit {
   template <typename Host> using context = jit_execution_context<Host>;
   template <typename Host>
-  using parser =
-      binary_parser<machine_code_writer<jit_execution_context<Host>>>;
+  using writer = machine_code_writer<jit_execution_context<Host>>;
+  template <typename Host> using parser = binary_parser<writer<Host>>;
   static constexpr bool is_jit = true;
 };
 
@@ -56,6 +68,35 @@ public:
       HostFunctions::resolve(_mod);
     _mod.finalize();
   }
+  // Compiles the module with gas metering, charging @costs against the
+  // counter set with set_gas_counter().
+  template <typename HostFunctions = nullptr_t>
+  backend(wasm_code_ptr &ptr, size_t sz, const gas_costs &costs,
+          HostFunctions host_functions = nullptr)
+      : backend(ptr, sz, jit_options{&costs}, host_functions) {}
+  // Compiles the module as @options asks for.
+  template <typename HostFunctions = nullptr_t>
+  backend(wasm_code_ptr &ptr, size_t sz, const jit_options &options,
+          HostFunctions = nullptr)
+      : _ctx(typename Impl::template parser<Host>{_mod.allocator}.parse_module2(
+            ptr, sz, configured(options))) {
+    _mod.metering = nullptr;
+    _mod.gas_metered = options.costs != nullptr;
+    if constexpr (!std::is_same_v<HostFunctions, nullptr_t>)
+      HostFunctions::resolve(_mod);
+    _mod.finalize();
+  }
+  // Loads a module compiled earlier from an image made by write_jit_image.
+  template <typename HostFunctions = nullptr_t>
+  backend(from_jit_image_t, const uint8_t *image, size_t sz,
+          HostFunctions = nullptr)
+      : _ctx(read_jit_image<typename Impl::template writer<Host>>(image, sz,
+                                                                   _mod)) {
+    static_assert(Impl::is_jit, "jit images need the jit backend");
+    if constexpr (!std::is_same_v<HostFunctions, nullptr_t>)
+      HostFunctions::resolve(_mod);
+    _mod.finalize();
+  }
 
   template <typename... Args>
   inline bool operator()(Host *host, const std::string_view &mod,
@@ -69,10 +110,23 @@ public:
     else
       _walloc->reset();
     _ctx.reset();
+    if (_snapshot_memory && !_snapshot) {
+      _snapshot = std::make_unique<memory_snapshot>(
+          _ctx.linear_memory(), _walloc->get_current_page());
+      _ctx.set_memory_snapshot(_snapshot.get());
+    }
     _ctx.execute_start(host, interpret_visitor(_ctx));
     return *this;
   }
 
+  // Makes the next initialize() snapshot the initial linear memory, which
+  // later instantiations map copy-on-write instead of applying the data
+  // segments again. Only modules with data segments benefit from it.
+  inline backend &enable_memory_snapshot() {
+    _snapshot_memory = _mod.memories.size() && _mod.data.size();
+    return *this;
+  }
+
   template <typename... Args>
   inline bool call_indirect(Host *host, uint32_t func_index, Args... args) {
     try {
@@ -174,6 +228,39 @@ public:
     }
   }
 
+  // Like timed_run, but the watchdog only sets the interrupt flag of the
+  // context, which the jit code polls on function entry and at loop heads.
+  // This stops the execution without changing the protection of the code
+  // pages, so other threads running the same module are not disturbed. Only
+  // modules compiled with jit_options::interrupt_polls poll the flag, others
+  // are run with timed_run.
+  template <typename Watchdog, typename F>
+  void polled_run(Watchdog &&wd, F &&f) {
+    static_assert(Impl::is_jit, "only jit code polls for interrupts");
+    if (!_mod.interrupt_polled)
+      return timed_run(static_cast<Watchdog &&>(wd), static_cast<F &&>(f));
+    std::atomic<bool> _timed_out = false;
+    _ctx.clear_interrupt();
+    auto clear_interrupt =
+        scope_guard{[this]() { _ctx.clear_interrupt(); }};
+    try {
+      auto wd_guard = wd.scoped_run([this, &_timed_out]() {
+        _timed_out = true;
+        _ctx.interrupt();
+      });
+      static_cast<F &&>(f)();
+    } catch (interrupt_exception &) {
+      if (_timed_out) {
+        throw timeout_exception{"execution timed out"};
+      } else {
+        throw;
+      }
+    }
+  }
+
+  // Stops the running execution at its next poll, see polled_run.
+  inline void interrupt() { _ctx.interrupt(); }
+
   template <typename Watchdog>
   inline void execute_all(Watchdog &&wd, Host *host = nullptr) {
     timed_run(static_cast<Watchdog &&>(wd), [&]() {
@@ -200,6 +287,7 @@ public:
   inline module &get_module() { return _mod; }
   inline void exit(const std::error_code &ec) { _ctx.exit(ec); }
   inline auto &get_context() { return _ctx; }
+  inline void set_gas_counter(int64_t *gas) { _ctx.set_gas_counter(gas); }
 
   static wasm_code read_wasm(const std::string &fname) {
     std::ifstream wasm_file(fname, std::ios::binary);
@@ -218,9 +306,17 @@ public:
   }
 
 private:
+  module &configured(const jit_options &options) {
+    _mod.metering = options.costs;
+    _mod.interrupt_polled = options.interrupt_polls;
+    return _mod;
+  }
+
   wasm_allocator *_walloc = nullptr; // non owning pointer
   module _mod;
   typename Impl::template context<Host> _ctx;
+  bool _snapshot_memory = false;
+  std::unique_ptr<memory_snapshot> _snapshot;
 };
 } // namespace vm
 } // namespace eosio
@@ -10,6 +10,7 @@ struct base_visitor {
   [[gnu::always_inline]] inline void operator()(const unreachable_t &) {}
   [[gnu::always_inline]] inline void operator()(const nop_t &) {}
   [[gnu::always_inline]] inline void operator()(const exit_t &) {}
+  [[gnu::always_inline]] inline void operator()(const charge_gas_t &) {}
   [[gnu::always_inline]] inline void operator()(const end_t &) {}
   [[gnu::always_inline]] inline void operator()(const return_t &) {}
   [[gnu::always_inline]] inline void operator()(block_t &) {}
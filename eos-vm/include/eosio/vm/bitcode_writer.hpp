@@ -1,6 +1,7 @@
 #pragma once
 
 #include <eosio/vm/allocator.hpp>
+#include <eosio/vm/exceptions.hpp>
 #include <eosio/vm/opcodes.hpp>
 #include <eosio/vm/types.hpp>
 #include <eosio/vm/vector.hpp>
@@ -22,31 +23,53 @@ public:
   explicit bitcode_writer(growable_allocator &alloc, std::size_t source_bytes,
                           module &mod)
       : _allocator(alloc), _code_segment_base(alloc.start_code()),
-        fb(alloc, source_bytes), _mod(&mod) {}
+        fb(alloc, source_bytes), _mod(&mod), _costs(mod.metering) {}
   ~bitcode_writer() { _allocator.end_code<false>(_code_segment_base); }
-  void emit_unreachable() { fb[op_index++] = unreachable_t{}; };
+  // Adds the cost of the next instruction to the charge of the straight-line
+  // code it belongs to.
+  void charge_instruction(uint8_t opcode) {
+    if (_costs)
+      _gas_cost += _costs->opcodes[opcode];
+  }
+  void emit_unreachable() {
+    fb[op_index++] = unreachable_t{};
+    end_gas_block();
+  };
   void emit_nop() { fb[op_index++] = nop_t{}; }
-  uint32_t emit_end() { return op_index; }
+  uint32_t emit_end() {
+    uint32_t result = op_index;
+    start_gas_block();
+    return result;
+  }
   uint32_t *emit_return(uint32_t depth_change) { return emit_br(depth_change); }
   void emit_block() {}
-  uint32_t emit_loop() { return op_index; }
+  uint32_t emit_loop() {
+    uint32_t result = op_index;
+    start_gas_block();
+    return result;
+  }
   uint32_t *emit_if() {
     if_t &instr = append_instr(if_t{});
+    start_gas_block();
     return &instr.pc;
   }
   uint32_t *emit_else(uint32_t *if_loc) {
     auto &else_ = append_instr(else_t{});
+    end_gas_block();
     *if_loc = _base_offset + op_index;
+    start_gas_block();
     return &else_.pc;
   }
   uint32_t *emit_br(uint32_t depth_change) {
     auto &instr = append_instr(br_t{});
     instr.data = depth_change;
+    end_gas_block();
     return &instr.pc;
   }
   uint32_t *emit_br_if(uint32_t depth_change) {
     auto &instr = append_instr(br_if_t{});
     instr.data = depth_change;
+    start_gas_block();
     return &instr.pc;
   }
 
@@ -79,6 +102,7 @@ public:
       auto result = emit_case(depth_change);
       EOS_VM_ASSERT(_this->fb[_this->op_index].is_a<error_t>(),
                     wasm_parse_exception, "overwrote br_table data");
+      _this->end_gas_block();
       return result;
     }
     br_table_t::elem_t *_br_tab;
@@ -302,11 +326,15 @@ public:
                      uint32_t idx) {
     op_index = 0;
     // pre-allocate for the function body code, so we have a big blob of memory
-    // to work with during function code parsing
-    fb = guarded_vector<opcode>{_allocator, _mod->code[idx].size};
+    // to work with during function code parsing. Metered code may need a
+    // charge_gas on top of every instruction that starts a block.
+    const std::size_t size = _mod->code[idx].size;
+    fb = guarded_vector<opcode>{_allocator, _costs ? 2 * size + 1 : size};
+    start_gas_block();
   }
   void emit_epilogue(const func_type &ft,
                      const guarded_vector<local_entry> &locals, uint32_t idx) {
+    end_gas_block();
     fb.resize(op_index + 1);
     uint32_t locals_count = 0;
     for (uint32_t i = 0; i < locals.size(); ++i) {
@@ -325,12 +353,43 @@ public:
   }
 
 private:
+  // Starts the next piece of straight-line code with a charge for its
+  // instructions, which is filled in once they are known.
+  void start_gas_block() {
+    if (!_costs)
+      return;
+    end_gas_block();
+    _gas_charge = op_index;
+    fb[op_index++] = charge_gas_t{};
+  }
+  void end_gas_block() {
+    if (_gas_charge != npos) {
+      if (_gas_cost != 0)
+        fb[_gas_charge].template get<charge_gas_t>().cost = _gas_cost;
+      else if (_gas_charge + 1 == op_index)
+        --op_index;
+      else
+        fb[_gas_charge] = nop_t{};
+    }
+    _gas_charge = npos;
+    _gas_cost = 0;
+  }
+
+  static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
   growable_allocator &_allocator;
   void *_code_segment_base;
   std::size_t op_index = 0;
   guarded_vector<opcode> fb;
   module *_mod;
   std::size_t _base_offset = 0;
+  // Set when the module is metered.
+  const gas_costs *_costs;
+  // The index of the charge_gas of the current straight-line code and the sum
+  // of the costs of its instructions so far. Code after an unconditional
+  // branch is never reached, so it has no charge.
+  std::size_t _gas_charge = npos;
+  uint64_t _gas_cost = 0;
 };
 
 } // namespace vm
@@ -44,6 +44,7 @@ struct debug_visitor : public interpret_visitor<ExecutionCTX> {
   EOS_VM_NUMERIC_OPS(DBG_VISIT)
   EOS_VM_CONVERSION_OPS(DBG_VISIT)
   EOS_VM_EXIT_OP(DBG_VISIT)
+  EOS_VM_GAS_OP(DBG_VISIT)
   EOS_VM_ERROR_OPS(DBG_VISIT)
 };
 
@@ -64,6 +65,7 @@ struct debug_visitor2 {
   EOS_VM_NUMERIC_OPS(DBG2_VISIT)
   EOS_VM_CONVERSION_OPS(DBG2_VISIT)
   EOS_VM_EXIT_OP(DBG2_VISIT)
+  EOS_VM_GAS_OP(DBG2_VISIT)
   EOS_VM_ERROR_OPS(DBG2_VISIT)
 };
 #undef DBG_VISIT
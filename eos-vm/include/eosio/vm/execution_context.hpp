@@ -3,7 +3,10 @@
 #include <eosio/vm/allocator.hpp>
 #include <eosio/vm/constants.hpp>
 #include <eosio/vm/exceptions.hpp>
+#include <eosio/vm/gas_metering.hpp>
 #include <eosio/vm/host_function.hpp>
+#include <eosio/vm/interrupt.hpp>
+#include <eosio/vm/memory_snapshot.hpp>
 #include <eosio/vm/opcodes.hpp>
 #include <eosio/vm/signals.hpp>
 #include <eosio/vm/types.hpp>
@@ -26,10 +29,17 @@
 namespace eosio {
 namespace vm {
 
-template <typename Derived, typename Host> class execution_context_base {
+template <typename Derived, typename Host>
+class execution_context_base : public gas_counter, public interrupt_flag {
 public:
   Derived &derived() { return static_cast<Derived &>(*this); }
-  execution_context_base(module &m) : _mod(m) {}
+  execution_context_base(module &m) : _mod(m) {
+    assert(static_cast<void *>(static_cast<gas_counter *>(this)) ==
+           static_cast<void *>(this));
+    assert(static_cast<void *>(static_cast<interrupt_flag *>(this)) ==
+           static_cast<void *>(reinterpret_cast<char *>(this) +
+                               interrupt_flag_offset));
+  }
 
   inline int32_t grow_linear_memory(int32_t pages) {
     const int32_t sz = _wasm_alloc->get_current_page();
@@ -59,6 +69,9 @@ public:
 
   inline module &get_module() { return _mod; }
   inline void set_wasm_allocator(wasm_allocator *alloc) { _wasm_alloc = alloc; }
+  inline void set_memory_snapshot(const memory_snapshot *snapshot) {
+    _snapshot = snapshot;
+  }
   inline auto get_wasm_allocator() { return _wasm_alloc; }
   inline char *linear_memory() { return _linear_memory; }
 
@@ -66,27 +79,32 @@ public:
 
   inline void reset() {
     _linear_memory = _wasm_alloc->get_base_ptr<char>();
-    if (_mod.memories.size()) {
-      // We'd better have reset the allocator before we get here
-      assert(_mod.memories[0].limits.initial >=
-             _wasm_alloc->get_current_page());
-      int err = grow_linear_memory(_mod.memories[0].limits.initial -
-                                   _wasm_alloc->get_current_page());
-      EOS_VM_ASSERT(err != -1, wasm_bad_alloc,
-                    "Cannot allocate initial linear memory.");
-    }
+    if (_snapshot && _wasm_alloc->get_current_page() == 0) {
+      // The snapshot already has the data segments applied.
+      _wasm_alloc->map_snapshot(_snapshot->fd(), _snapshot->pages());
+    } else {
+      if (_mod.memories.size()) {
+        // We'd better have reset the allocator before we get here
+        assert(_mod.memories[0].limits.initial >=
+               _wasm_alloc->get_current_page());
+        int err = grow_linear_memory(_mod.memories[0].limits.initial -
+                                     _wasm_alloc->get_current_page());
+        EOS_VM_ASSERT(err != -1, wasm_bad_alloc,
+                      "Cannot allocate initial linear memory.");
+      }
 
-    for (uint32_t i = 0; i < _mod.data.size(); i++) {
-      const auto &data_seg = _mod.data[i];
-      uint32_t offset = data_seg.offset.value.i32; // force to unsigned
-      auto available_memory =
-          _mod.memories[0].limits.initial * static_cast<uint64_t>(page_size);
-      auto required_memory =
-          static_cast<uint64_t>(offset) + data_seg.data.size();
-      EOS_VM_ASSERT(required_memory <= available_memory, wasm_memory_exception,
-                    "data out of range");
-      auto addr = _linear_memory + offset;
-      memcpy((char *)(addr), data_seg.data.raw(), data_seg.data.size());
+      for (uint32_t i = 0; i < _mod.data.size(); i++) {
+        const auto &data_seg = _mod.data[i];
+        uint32_t offset = data_seg.offset.value.i32; // force to unsigned
+        auto available_memory =
+            _mod.memories[0].limits.initial * static_cast<uint64_t>(page_size);
+        auto required_memory =
+            static_cast<uint64_t>(offset) + data_seg.data.size();
+        EOS_VM_ASSERT(required_memory <= available_memory,
+                      wasm_memory_exception, "data out of range");
+        auto addr = _linear_memory + offset;
+        memcpy((char *)(addr), data_seg.data.raw(), data_seg.data.size());
+      }
     }
 
     // reset the mutable globals
@@ -128,6 +146,7 @@ protected:
   char *_linear_memory = nullptr;
   module &_mod;
   wasm_allocator *_wasm_alloc;
+  const memory_snapshot *_snapshot = nullptr;
   registered_host_functions<Host> _rhf;
   std::error_code _error_code;
 };
@@ -152,57 +171,10 @@ public:
 
   inline operand_stack &get_operand_stack() { return _os; }
 
+  // The arguments are converted straight from the native stack, without
+  // going through the operand stack.
   inline native_value call_host_function(native_value *stack, uint32_t index) {
-    const auto &ft = _mod.get_function_type(index);
-    uint32_t num_params = ft.param_types.size();
-#ifndef NDEBUG
-    uint32_t original_operands = _os.size();
-#endif
-    for (uint32_t i = 0; i < ft.param_types.size(); ++i) {
-      switch (ft.param_types[i]) {
-      case i32:
-        _os.push(i32_const_t{stack[num_params - i - 1].i32});
-        break;
-      case i64:
-        _os.push(i64_const_t{stack[num_params - i - 1].i64});
-        break;
-      case f32:
-        _os.push(f32_const_t{stack[num_params - i - 1].f32});
-        break;
-      case f64:
-        _os.push(f64_const_t{stack[num_params - i - 1].f64});
-        break;
-      default:
-        assert(!"Unexpected type in param_types.");
-      }
-    }
-    _rhf(_host, *this, _mod.import_functions[index]);
-    native_value result{uint32_t{0}};
-    // guarantee that the junk bits are zero, to avoid problems.
-    auto set_result = [&result](auto val) {
-      std::memcpy(&result, &val, sizeof(val));
-    };
-    if (ft.return_count) {
-      operand_stack_elem el = _os.pop();
-      switch (ft.return_type) {
-      case i32:
-        set_result(el.to_ui32());
-        break;
-      case i64:
-        set_result(el.to_ui64());
-        break;
-      case f32:
-        set_result(el.to_f32());
-        break;
-      case f64:
-        set_result(el.to_f64());
-        break;
-      default:
-        assert(!"Unexpected function return type.");
-      }
-    }
-    assert(_os.size() == original_operands);
-    return result;
+    return _rhf.call_native(_host, *this, _mod.bound_imports[index], stack);
   }
 
   inline void reset() {
@@ -377,7 +349,7 @@ public:
       type_check(ft);
       inc_pc();
       push_call(activation_frame{nullptr, 0});
-      _rhf(_state.host, *this, _mod.import_functions[index]);
+      _rhf(_state.host, *this, _mod.bound_imports[index]);
       pop_call();
     } else {
       // const auto& ft = _mod.types[_mod.functions[index -
@@ -610,7 +582,7 @@ public:
     type_check(_mod.get_function_type(func_index));
 
     if (func_index < _mod.get_imported_functions_size()) {
-      _rhf(_state.host, *this, _mod.import_functions[func_index]);
+      _rhf(_state.host, *this, _mod.bound_imports[func_index]);
     } else {
       _state.pc = _mod.get_function_pc(func_index);
       setup_locals(func_index);
@@ -693,6 +665,8 @@ private:
                                                 CREATE_TABLE_ENTRY)
                                                 EOS_VM_EXIT_OP(
                                                     CREATE_TABLE_ENTRY)
+                                                    EOS_VM_GAS_OP(
+                                                        CREATE_TABLE_ENTRY)
                                                     EOS_VM_EMPTY_OPS(
                                                         CREATE_TABLE_ENTRY)
                                                         EOS_VM_ERROR_OPS(
@@ -717,6 +691,7 @@ private:
       EOS_VM_NUMERIC_OPS(CREATE_LABEL);
       EOS_VM_CONVERSION_OPS(CREATE_LABEL);
       EOS_VM_EXIT_OP(CREATE_EXIT_LABEL);
+      EOS_VM_GAS_OP(CREATE_LABEL);
       EOS_VM_EMPTY_OPS(CREATE_EMPTY_LABEL);
       EOS_VM_ERROR_OPS(CREATE_LABEL);
     __ev_last:
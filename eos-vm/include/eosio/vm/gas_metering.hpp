@@ -0,0 +1,55 @@
+#pragma once
+
+#include <eosio/vm/exceptions.hpp>
+
+#include <array>
+#include <cstdint>
+#include <limits>
+
+// Gas metering built into the generated code. The costs of the instructions of
+// each straight-line piece of code are summed up when the module is compiled
+// and charged once on entry to it, and execution traps as soon as the counter
+// of the running context goes negative. The jit emits the charge inline, the
+// interpreter gets a charge_gas instruction for it.
+
+namespace eosio {
+namespace vm {
+
+// Gas charged for each wasm instruction, indexed by opcode.
+struct gas_costs {
+  std::array<uint32_t, 256> opcodes = {};
+
+  // Charges @cost for every instruction.
+  static gas_costs uniform(uint32_t cost) {
+    gas_costs result;
+    result.opcodes.fill(cost);
+    return result;
+  }
+};
+
+// The gas counter an execution context charges metered code against. Nothing
+// is charged until set_gas_counter() points it at the caller's counter.
+//
+// The jit finds the counter at the address of the context, so this has to be
+// the first base of the context.
+class gas_counter {
+public:
+  gas_counter() = default;
+  gas_counter(const gas_counter &) : gas_counter() {}
+  gas_counter &operator=(const gas_counter &) { return *this; }
+
+  void set_gas_counter(int64_t *gas) { _gas = gas ? gas : &_unlimited; }
+  int64_t *get_gas_counter() const { return _gas; }
+
+  void charge_gas(uint64_t cost) {
+    EOS_VM_ASSERT((*_gas -= static_cast<int64_t>(cost)) >= 0,
+                  out_of_gas_exception, "out of gas");
+  }
+
+protected:
+  int64_t *_gas = &_unlimited;
+  int64_t _unlimited = std::numeric_limits<int64_t>::max();
+};
+
+} // namespace vm
+} // namespace eosio
@@ -6,6 +6,8 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <algorithm>
+#include <cstring>
 #include <functional>
 #include <limits>
 #include <memory>
@@ -496,6 +498,53 @@ auto create_function(std::index_sequence<Is...>) {
       }};
 }
 
+// The arguments of a host call on the native stack of the jit, the last one
+// on top. It stands in for the operand stack when the arguments are converted,
+// so they go straight to the host function without being pushed onto it.
+struct native_args {
+  struct elem {
+    template <typename T> T get() const {
+      if constexpr (std::is_same_v<T, i32_const_t>)
+        return T{_value.i32};
+      else if constexpr (std::is_same_v<T, i64_const_t>)
+        return T{_value.i64};
+      else if constexpr (std::is_same_v<T, f32_const_t>)
+        return T{_value.f32};
+      else
+        return T{_value.f64};
+    }
+    native_value _value;
+  };
+  elem get_back(std::size_t i) const { return {_stack[i]}; }
+  native_value *_stack;
+};
+
+template <typename T, typename WAlloc>
+native_value native_result(T &&res, WAlloc *walloc) {
+  // guarantee that the junk bits are zero, to avoid problems.
+  native_value result{uint64_t{0}};
+  if constexpr (!std::is_same_v<std::decay_t<T>, maybe_void_t>) {
+    auto value = detail::resolve_result(static_cast<T &&>(res), walloc).data;
+    std::memcpy(&result, &value, sizeof(value));
+  }
+  return result;
+}
+
+// Same as create_function, for calls from the jit.
+template <typename Walloc, typename Cls, typename Cls2, auto F, typename R,
+          typename Args, size_t... Is>
+auto create_native_function(std::index_sequence<Is...>) {
+  return +[](Cls *self, Walloc *walloc, native_value *stack) {
+    native_args args{stack};
+    return native_result(
+        (invoke_with_cons<F, Cls2>(self,
+                                   detail::pack_args<Args>::apply(walloc, args),
+                                   std::index_sequence<Is...>{}),
+         maybe_void),
+        walloc);
+  };
+}
+
 template <typename T> constexpr auto to_wasm_type_v = to_wasm_type<T>();
 
 struct host_function {
@@ -541,6 +590,8 @@ template <typename Cls> struct registered_host_functions {
     std::vector<host_function> host_functions;
     std::vector<std::function<void(Cls *, WAlloc *, operand_stack &)>>
         functions;
+    std::vector<native_value (*)(Cls *, WAlloc *, native_value *)>
+        native_functions;
     size_t current_index = 0;
   };
 
@@ -557,29 +608,74 @@ template <typename Cls> struct registered_host_functions {
     static constexpr auto is =
         std::make_index_sequence<std::tuple_size_v<deduced_full_ts>>();
     auto &current_mappings = get_mappings<WAlloc>();
-    current_mappings.named_mapping[{mod, name}] =
-        current_mappings.current_index++;
-    current_mappings.functions.push_back(
-        create_function<WAlloc, Cls, Cls2, Func, res_t, deduced_full_ts>(is));
+    auto function =
+        create_function<WAlloc, Cls, Cls2, Func, res_t, deduced_full_ts>(is);
+    auto native_function =
+        create_native_function<WAlloc, Cls, Cls2, Func, res_t,
+                               deduced_full_ts>(is);
+    // Adding a name again replaces its function, so the registry does not
+    // grow when the same functions are added more than once.
+    auto [it, inserted] = current_mappings.named_mapping.try_emplace(
+        {mod, name}, current_mappings.current_index);
+    if (!inserted) {
+      current_mappings.functions[it->second] = std::move(function);
+      current_mappings.native_functions[it->second] = native_function;
+      return;
+    }
+    current_mappings.current_index++;
+    current_mappings.functions.push_back(std::move(function));
+    current_mappings.native_functions.push_back(native_function);
   }
 
+  // Maps the imported functions of @mod to the indices of the registered
+  // functions. The indices are kept in the module, so a module that is
+  // reused does not need to be resolved again.
   template <typename Module> static void resolve(Module &mod) {
-    auto &imports = mod.import_functions;
+    resolve(mod, std::string{});
+  }
+
+  // Like resolve(), except that functions registered under the module name
+  // of an import followed by @variant are preferred. This binds a different
+  // function to some imports without changing the module.
+  template <typename Module>
+  static void resolve(Module &mod, const std::string &variant) {
+    const std::vector<uint32_t> imports = resolve_imports(mod, variant);
+    std::copy(imports.begin(), imports.end(), mod.import_functions.raw());
+  }
+
+  // Returns the indices of the registered functions the imported functions of
+  // @mod map to, as resolve() would store them, without binding them. A table
+  // kept this way is bound with module::bind_imports().
+  template <typename Module>
+  static std::vector<uint32_t> resolve_imports(const Module &mod,
+                                               const std::string &variant) {
+    std::vector<uint32_t> imports(mod.get_imported_functions_size());
     auto &current_mappings = get_mappings<wasm_allocator>();
-    for (int i = 0; i < mod.imports.size(); i++) {
+    uint32_t func_idx = 0;
+    for (uint32_t i = 0; i < mod.imports.size(); i++) {
+      if (mod.imports[i].kind != external_kind::Function)
+        continue;
       std::string mod_name =
           std::string((char *)mod.imports[i].module_str.raw(),
                       mod.imports[i].module_str.size());
       std::string fn_name = std::string((char *)mod.imports[i].field_str.raw(),
                                         mod.imports[i].field_str.size());
-      EOS_VM_ASSERT(current_mappings.named_mapping.count({mod_name, fn_name}),
+      auto it = current_mappings.named_mapping.end();
+      if (!variant.empty())
+        it = current_mappings.named_mapping.find(
+            {mod_name + variant, fn_name});
+      if (it == current_mappings.named_mapping.end())
+        it = current_mappings.named_mapping.find({mod_name, fn_name});
+      EOS_VM_ASSERT(it != current_mappings.named_mapping.end(),
                     wasm_link_exception, "no mapping for imported function");
-      imports[i] = current_mappings.named_mapping[{mod_name, fn_name}];
+      imports[func_idx] = it->second;
 #ifndef NDEBUG
       std::cerr << "module: " << mod_name << " func: " << fn_name
-                << " import host func idx: " << imports[i] << std::endl;
+                << " import host func idx: " << imports[func_idx] << std::endl;
 #endif
+      func_idx++;
     }
+    return imports;
   }
 
   template <typename Execution_Context>
@@ -587,6 +683,15 @@ template <typename Cls> struct registered_host_functions {
     const auto &_func = get_mappings<wasm_allocator>().functions[index];
     std::invoke(_func, host, ctx.get_wasm_allocator(), ctx.get_operand_stack());
   }
+
+  // Calls a host function with its arguments on the native stack of the jit.
+  template <typename Execution_Context>
+  native_value call_native(Cls *host, Execution_Context &ctx, uint32_t index,
+                           native_value *stack) {
+    const auto _func =
+        get_mappings<wasm_allocator>().native_functions[index];
+    return _func(host, ctx.get_wasm_allocator(), stack);
+  }
 };
 
 template <typename Cls, typename Cls2, auto F> struct registered_function {
@@ -50,6 +50,11 @@ template <typename ExecutionContext> struct interpret_visitor : base_visitor {
     context.inc_pc();
   }
 
+  [[gnu::always_inline]] inline void operator()(const charge_gas_t &op) {
+    context.inc_pc();
+    context.charge_gas(op.cost);
+  }
+
   [[gnu::always_inline]] inline void operator()(const end_t &op) {
     context.inc_pc();
   }
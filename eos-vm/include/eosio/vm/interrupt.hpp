@@ -0,0 +1,41 @@
+#pragma once
+
+#include <eosio/vm/gas_metering.hpp>
+
+#include <atomic>
+#include <cstdint>
+
+// Cooperative interruption of jit code. The jit polls a flag of the running
+// context on function entry and at the head of every loop, and traps once it
+// is set, so a watchdog can stop one execution without touching the
+// protection of the code pages every thread shares.
+
+namespace eosio {
+namespace vm {
+
+// The flag an execution context is interrupted through. It can be set from
+// any thread.
+//
+// The jit finds the flag right after the gas counter, so this has to be the
+// second base of the context.
+class interrupt_flag {
+public:
+  interrupt_flag() = default;
+  interrupt_flag(const interrupt_flag &) : interrupt_flag() {}
+  interrupt_flag &operator=(const interrupt_flag &) { return *this; }
+
+  void interrupt() { _interrupted.store(1, std::memory_order_relaxed); }
+  void clear_interrupt() { _interrupted.store(0, std::memory_order_relaxed); }
+  bool interrupted() const {
+    return _interrupted.load(std::memory_order_relaxed) != 0;
+  }
+
+protected:
+  std::atomic<uint32_t> _interrupted = 0;
+};
+
+// Offset of the flag from the address of the context.
+constexpr int8_t interrupt_flag_offset = sizeof(gas_counter);
+
+} // namespace vm
+} // namespace eosio
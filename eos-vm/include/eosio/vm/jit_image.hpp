@@ -0,0 +1,323 @@
+#pragma once
+
+#include <eosio/vm/allocator.hpp>
+#include <eosio/vm/exceptions.hpp>
+#include <eosio/vm/types.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include <sys/mman.h>
+
+// A jit image holds a module compiled by the jit backend in a form that another
+// process can load without parsing or compiling it again: the module metadata,
+// the machine code, and the relocations of the absolute addresses in that code.
+// Images are only meaningful to the same build of eos-vm on the same
+// architecture, which the caller has to ensure.
+
+namespace eosio {
+namespace vm {
+
+// Bumped whenever the layout of the image or of the generated code changes.
+constexpr uint32_t jit_image_version = 4;
+
+struct from_jit_image_t {};
+inline constexpr from_jit_image_t from_jit_image{};
+
+namespace detail {
+class image_writer {
+public:
+  explicit image_writer(std::vector<uint8_t> &out) : _out(out) {}
+
+  template <typename T> void write(const T &value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    write_bytes(&value, sizeof(T));
+  }
+  void write_bytes(const void *data, std::size_t size) {
+    auto bytes = static_cast<const uint8_t *>(data);
+    _out.insert(_out.end(), bytes, bytes + size);
+  }
+  template <typename T> void write_vector(const guarded_vector<T> &vec) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    write<uint64_t>(vec.size());
+    write_bytes(vec.raw(), vec.size() * sizeof(T));
+  }
+
+private:
+  std::vector<uint8_t> &_out;
+};
+
+class image_reader {
+public:
+  image_reader(const uint8_t *data, std::size_t size)
+      : _pos(data), _end(data + size) {}
+
+  template <typename T> T read() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    T result;
+    std::memcpy(&result, read_bytes(sizeof(T)), sizeof(T));
+    return result;
+  }
+  const uint8_t *read_bytes(std::size_t size) {
+    EOS_VM_ASSERT(size <= remaining(), wasm_parse_exception,
+                  "jit image is truncated");
+    const uint8_t *result = _pos;
+    _pos += size;
+    return result;
+  }
+  std::size_t read_size(std::size_t element_size) {
+    auto size = read<uint64_t>();
+    EOS_VM_ASSERT(size <= remaining() / element_size, wasm_parse_exception,
+                  "jit image is truncated");
+    return size;
+  }
+  template <typename T>
+  void read_vector(growable_allocator &alloc, guarded_vector<T> &vec) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    auto size = read_size(sizeof(T));
+    vec = guarded_vector<T>(alloc, size);
+    std::memcpy(vec.raw(), read_bytes(size * sizeof(T)), size * sizeof(T));
+  }
+  std::size_t remaining() const { return _end - _pos; }
+
+private:
+  const uint8_t *_pos;
+  const uint8_t *_end;
+};
+} // namespace detail
+
+// Appends the image of @mod to @out. Returns false if the module was not
+// compiled by the jit or uses features images do not support.
+inline bool write_jit_image(const module &mod, std::vector<uint8_t> &out) {
+  const growable_allocator &alloc = mod.allocator;
+  if (!alloc.is_jit || !alloc._code_base)
+    return false;
+  for (uint32_t i = 0; i < mod.imports.size(); i++) {
+    if (mod.imports[i].kind == external_kind::Table)
+      return false;
+  }
+
+  detail::image_writer w(out);
+  w.write(jit_image_version);
+  w.write(mod.start);
+  w.write(mod.maximum_stack);
+  w.write(mod.gas_metered);
+  w.write(mod.interrupt_polled);
+
+  w.write<uint64_t>(mod.types.size());
+  for (uint32_t i = 0; i < mod.types.size(); i++) {
+    const func_type &ft = mod.types[i];
+    w.write(ft.form);
+    w.write_vector(ft.param_types);
+    w.write(ft.return_count);
+    w.write(ft.return_type);
+  }
+
+  w.write<uint64_t>(mod.imports.size());
+  for (uint32_t i = 0; i < mod.imports.size(); i++) {
+    const import_entry &ie = mod.imports[i];
+    w.write_vector(ie.module_str);
+    w.write_vector(ie.field_str);
+    w.write(ie.kind);
+    switch (ie.kind) {
+    case external_kind::Function:
+      w.write(ie.type.func_t);
+      break;
+    case external_kind::Memory:
+      w.write(ie.type.mem_t);
+      break;
+    case external_kind::Global:
+      w.write(ie.type.global_t);
+      break;
+    default:
+      break;
+    }
+  }
+
+  w.write_vector(mod.functions);
+
+  w.write<uint64_t>(mod.tables.size());
+  for (uint32_t i = 0; i < mod.tables.size(); i++) {
+    const table_type &tt = mod.tables[i];
+    w.write(tt.element_type);
+    w.write(tt.limits);
+    w.write_vector(tt.table);
+  }
+
+  w.write_vector(mod.memories);
+  w.write_vector(mod.globals);
+
+  w.write<uint64_t>(mod.exports.size());
+  for (uint32_t i = 0; i < mod.exports.size(); i++) {
+    const export_entry &ee = mod.exports[i];
+    w.write_vector(ee.field_str);
+    w.write(ee.kind);
+    w.write(ee.index);
+  }
+
+  w.write<uint64_t>(mod.elements.size());
+  for (uint32_t i = 0; i < mod.elements.size(); i++) {
+    const elem_segment &es = mod.elements[i];
+    w.write(es.index);
+    w.write(es.offset);
+    w.write_vector(es.elems);
+  }
+
+  w.write<uint64_t>(mod.code.size());
+  for (uint32_t i = 0; i < mod.code.size(); i++) {
+    const function_body &fb = mod.code[i];
+    w.write(fb.size);
+    w.write_vector(fb.locals);
+    w.write<uint64_t>(fb.jit_code_offset);
+  }
+
+  w.write<uint64_t>(mod.data.size());
+  for (uint32_t i = 0; i < mod.data.size(); i++) {
+    const data_segment &ds = mod.data[i];
+    w.write(ds.index);
+    w.write(ds.offset);
+    w.write_vector(ds.data);
+  }
+
+  w.write_vector(mod.type_aliases);
+  w.write_vector(mod.fast_functions);
+
+  w.write<uint64_t>(mod.jit_relocations.size());
+  w.write_bytes(mod.jit_relocations.data(),
+                mod.jit_relocations.size() * sizeof(jit_relocation));
+
+  // The code pages may be execute-only, so they are made readable while they
+  // are copied out.
+  w.write<uint64_t>(alloc._code_size);
+  int err = mprotect(alloc._code_base, alloc._code_size, PROT_READ | PROT_EXEC);
+  EOS_VM_ASSERT(err == 0, wasm_bad_alloc, "mprotect failed");
+  w.write_bytes(alloc._code_base, alloc._code_size);
+  err = mprotect(alloc._code_base, alloc._code_size, PROT_EXEC);
+  EOS_VM_ASSERT(err == 0, wasm_bad_alloc, "mprotect failed");
+  return true;
+}
+
+// Rebuilds @mod from an image. The machine code is relocated against this
+// process and copied into executable memory the same way the jit does it.
+// Writer is the machine_code_writer the image was produced by.
+template <typename Writer>
+module &read_jit_image(const uint8_t *image, std::size_t size, module &mod) {
+  growable_allocator &alloc = mod.allocator;
+  detail::image_reader r(image, size);
+  EOS_VM_ASSERT(r.read<uint32_t>() == jit_image_version, wasm_parse_exception,
+                "jit image version did not match");
+  mod.start = r.read<uint32_t>();
+  mod.maximum_stack = r.read<uint64_t>();
+  mod.gas_metered = r.read<bool>();
+  mod.interrupt_polled = r.read<bool>();
+
+  mod.types = decltype(mod.types)(alloc, r.read_size(1));
+  for (uint32_t i = 0; i < mod.types.size(); i++) {
+    func_type &ft = mod.types[i];
+    ft.form = r.read<value_type>();
+    r.read_vector(alloc, ft.param_types);
+    ft.return_count = r.read<uint8_t>();
+    ft.return_type = r.read<value_type>();
+  }
+
+  mod.imports = decltype(mod.imports)(alloc, r.read_size(1));
+  for (uint32_t i = 0; i < mod.imports.size(); i++) {
+    import_entry &ie = mod.imports[i];
+    r.read_vector(alloc, ie.module_str);
+    r.read_vector(alloc, ie.field_str);
+    ie.kind = r.read<external_kind>();
+    switch (ie.kind) {
+    case external_kind::Function:
+      ie.type.func_t = r.read<uint32_t>();
+      break;
+    case external_kind::Memory:
+      ie.type.mem_t = r.read<memory_type>();
+      break;
+    case external_kind::Global:
+      ie.type.global_t = r.read<global_type>();
+      break;
+    default:
+      EOS_VM_ASSERT(false, wasm_parse_exception,
+                    "jit image has an unsupported import");
+    }
+  }
+
+  r.read_vector(alloc, mod.functions);
+
+  mod.tables = decltype(mod.tables)(alloc, r.read_size(1));
+  for (uint32_t i = 0; i < mod.tables.size(); i++) {
+    table_type &tt = mod.tables[i];
+    tt.element_type = r.read<elem_type>();
+    tt.limits = r.read<resizable_limits>();
+    r.read_vector(alloc, tt.table);
+  }
+
+  r.read_vector(alloc, mod.memories);
+  r.read_vector(alloc, mod.globals);
+
+  mod.exports = decltype(mod.exports)(alloc, r.read_size(1));
+  for (uint32_t i = 0; i < mod.exports.size(); i++) {
+    export_entry &ee = mod.exports[i];
+    r.read_vector(alloc, ee.field_str);
+    ee.kind = r.read<external_kind>();
+    ee.index = r.read<uint32_t>();
+  }
+
+  mod.elements = decltype(mod.elements)(alloc, r.read_size(1));
+  for (uint32_t i = 0; i < mod.elements.size(); i++) {
+    elem_segment &es = mod.elements[i];
+    es.index = r.read<uint32_t>();
+    es.offset = r.read<init_expr>();
+    r.read_vector(alloc, es.elems);
+  }
+
+  mod.code = decltype(mod.code)(alloc, r.read_size(1));
+  for (uint32_t i = 0; i < mod.code.size(); i++) {
+    function_body &fb = mod.code[i];
+    fb.size = r.read<uint32_t>();
+    r.read_vector(alloc, fb.locals);
+    fb.code = nullptr;
+    fb.jit_code_offset = r.read<uint64_t>();
+  }
+
+  mod.data = decltype(mod.data)(alloc, r.read_size(1));
+  for (uint32_t i = 0; i < mod.data.size(); i++) {
+    data_segment &ds = mod.data[i];
+    ds.index = r.read<uint32_t>();
+    ds.offset = r.read<init_expr>();
+    r.read_vector(alloc, ds.data);
+  }
+
+  r.read_vector(alloc, mod.type_aliases);
+  r.read_vector(alloc, mod.fast_functions);
+
+  mod.jit_relocations.resize(r.read_size(sizeof(jit_relocation)));
+  std::memcpy(mod.jit_relocations.data(),
+              r.read_bytes(mod.jit_relocations.size() * sizeof(jit_relocation)),
+              mod.jit_relocations.size() * sizeof(jit_relocation));
+
+  const std::size_t code_size = r.read_size(1);
+  EOS_VM_ASSERT(r.remaining() == code_size, wasm_parse_exception,
+                "jit image has trailing data");
+  for (uint32_t i = 0; i < mod.code.size(); i++) {
+    EOS_VM_ASSERT(mod.code[i].jit_code_offset < code_size,
+                  wasm_parse_exception, "jit image has invalid code offsets");
+  }
+
+  void *code_base = alloc.start_code();
+  auto code = alloc.alloc<unsigned char>(code_size);
+  std::memcpy(code, r.read_bytes(code_size), code_size);
+  for (const jit_relocation &reloc : mod.jit_relocations) {
+    EOS_VM_ASSERT(reloc.offset + sizeof(void *) <= code_size,
+                  wasm_parse_exception, "jit image has invalid relocations");
+    void *address = Writer::symbol_address(mod, reloc.symbol, reloc.index);
+    std::memcpy(code + reloc.offset, &address, sizeof(address));
+  }
+  alloc.end_code<true>(code_base);
+  return mod;
+}
+
+} // namespace vm
+} // namespace eosio
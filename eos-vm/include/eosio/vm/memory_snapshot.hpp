@@ -0,0 +1,66 @@
+#pragma once
+
+#include <eosio/vm/constants.hpp>
+#include <eosio/vm/exceptions.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// A memory snapshot holds the initial linear memory of a module, with its data
+// segments applied, in a memfd. Instances map it copy-on-write instead of
+// copying the data segments again, so they only pay for the pages they write.
+
+namespace eosio {
+namespace vm {
+
+class memory_snapshot {
+public:
+  // Copies the first @pages wasm pages of @memory. Pages that are all zero
+  // are left as holes in the file.
+  memory_snapshot(const char *memory, uint32_t pages) : _pages(pages) {
+    const std::size_t size = static_cast<std::size_t>(pages) * page_size;
+    _fd = memfd_create("eos-vm-snapshot", MFD_CLOEXEC);
+    EOS_VM_ASSERT(_fd >= 0, wasm_bad_alloc, "memfd_create failed");
+    if (size == 0)
+      return;
+    if (ftruncate(_fd, size) != 0) {
+      ::close(_fd);
+      EOS_VM_ASSERT(false, wasm_bad_alloc, "ftruncate failed");
+    }
+    char *image =
+        (char *)mmap(nullptr, size, PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (image == MAP_FAILED) {
+      ::close(_fd);
+      EOS_VM_ASSERT(false, wasm_bad_alloc, "mmap failed");
+    }
+    const std::size_t chunk =
+        static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    for (std::size_t offset = 0; offset < size; offset += chunk) {
+      if (!is_zero(memory + offset, chunk))
+        std::memcpy(image + offset, memory + offset, chunk);
+    }
+    munmap(image, size);
+  }
+  ~memory_snapshot() { ::close(_fd); }
+
+  memory_snapshot(const memory_snapshot &) = delete;
+  memory_snapshot &operator=(const memory_snapshot &) = delete;
+
+  int fd() const { return _fd; }
+  uint32_t pages() const { return _pages; }
+
+private:
+  static bool is_zero(const char *data, std::size_t size) {
+    return data[0] == 0 && std::memcmp(data, data + 1, size - 1) == 0;
+  }
+
+  int _fd = -1;
+  uint32_t _pages;
+};
+
+} // namespace vm
+} // namespace eosio
@@ -20,6 +20,7 @@ enum opcodes {
                               EOS_VM_NUMERIC_OPS(EOS_VM_CREATE_ENUM)
                                   EOS_VM_CONVERSION_OPS(EOS_VM_CREATE_ENUM)
                                       EOS_VM_EXIT_OP(EOS_VM_CREATE_ENUM)
+                                          EOS_VM_GAS_OP(EOS_VM_CREATE_ENUM)
                                           EOS_VM_EMPTY_OPS(EOS_VM_CREATE_ENUM)
                                               EOS_VM_ERROR_OPS(
                                                   EOS_VM_CREATE_ENUM)
@@ -40,6 +41,7 @@ struct opcode_utils {
                                   EOS_VM_NUMERIC_OPS(EOS_VM_CREATE_MAP)
                                       EOS_VM_CONVERSION_OPS(EOS_VM_CREATE_MAP)
                                           EOS_VM_EXIT_OP(EOS_VM_CREATE_MAP)
+                                              EOS_VM_GAS_OP(EOS_VM_CREATE_MAP)
                                               EOS_VM_EMPTY_OPS(
                                                   EOS_VM_CREATE_MAP)
                                                   EOS_VM_ERROR_OPS(
@@ -69,6 +71,7 @@ EOS_VM_COMPARISON_OPS(EOS_VM_CREATE_TYPES)
 EOS_VM_NUMERIC_OPS(EOS_VM_CREATE_TYPES)
 EOS_VM_CONVERSION_OPS(EOS_VM_CREATE_TYPES)
 EOS_VM_EXIT_OP(EOS_VM_CREATE_EXIT_TYPE)
+EOS_VM_GAS_OP(EOS_VM_CREATE_GAS_TYPE)
 EOS_VM_EMPTY_OPS(EOS_VM_CREATE_TYPES)
 EOS_VM_ERROR_OPS(EOS_VM_CREATE_TYPES)
 
@@ -85,6 +88,7 @@ using opcode = variant<
                                 EOS_VM_NUMERIC_OPS(EOS_VM_IDENTITY)
                                     EOS_VM_CONVERSION_OPS(EOS_VM_IDENTITY)
                                         EOS_VM_EXIT_OP(EOS_VM_IDENTITY)
+                                            EOS_VM_GAS_OP(EOS_VM_IDENTITY)
                                             EOS_VM_EMPTY_OPS(EOS_VM_IDENTITY)
                                                 EOS_VM_ERROR_OPS(
                                                     EOS_VM_IDENTITY_END)>;
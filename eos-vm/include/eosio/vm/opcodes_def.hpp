@@ -212,8 +212,9 @@
    opcode_macro(f64_reinterpret_i64, 0xBF)
 #define EOS_VM_EXIT_OP(opcode_macro)            \
    opcode_macro(exit, 0xC0)
+#define EOS_VM_GAS_OP(opcode_macro)             \
+   opcode_macro(charge_gas, 0xC1)
 #define EOS_VM_EMPTY_OPS(opcode_macro)          \
-   opcode_macro(empty0xC1, 0xC1)                \
    opcode_macro(empty0xC2, 0xC2)                \
    opcode_macro(empty0xC3, 0xC3)                \
    opcode_macro(empty0xC4, 0xC4)                \
@@ -317,6 +318,16 @@
     static constexpr uint8_t opcode = code;                                    \
   };
 
+// Only emitted by the bitcode writer of a gas metered module: charges the cost
+// of the basic block that follows it.
+#define EOS_VM_CREATE_GAS_TYPE(name, code)                                     \
+  struct EOS_VM_OPCODE_T(name) {                                               \
+    EOS_VM_OPCODE_T(name)() = default;                                         \
+    explicit EOS_VM_OPCODE_T(name)(uint64_t c) : cost(c) {}                    \
+    uint64_t cost = 0;                                                         \
+    static constexpr uint8_t opcode = code;                                    \
+  };
+
 #define EOS_VM_CREATE_CONTROL_FLOW_TYPES(name, code)                           \
   struct EOS_VM_OPCODE_T(name) {                                               \
     EOS_VM_OPCODE_T(name)() {}                                                 \
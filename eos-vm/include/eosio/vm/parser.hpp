@@ -621,6 +621,7 @@ public:
                     wasm_parse_exception,
                     "nested structures validation failure");
 
+      code_writer.charge_instruction(*code);
       switch (*code++) {
       case opcodes::unreachable:
         code_writer.emit_unreachable();
@@ -6,6 +6,7 @@
  */
 
 #include <eosio/vm/allocator.hpp>
+#include <eosio/vm/gas_metering.hpp>
 #include <eosio/vm/guarded_ptr.hpp>
 #include <eosio/vm/opcodes.hpp>
 #include <eosio/vm/vector.hpp>
@@ -157,6 +158,29 @@ struct data_segment {
   guarded_vector<uint8_t> data;
 };
 
+// Runtime addresses the jit writes into the machine code as immediates.
+enum class jit_symbol : uint32_t {
+  global, // address of the current value of a global variable
+  current_memory,
+  grow_memory,
+  call_host_function,
+  on_unreachable,
+  on_fp_error,
+  on_call_indirect_error,
+  on_type_error,
+  on_stack_overflow,
+  on_out_of_gas,
+  on_interrupt
+};
+
+// Locates an absolute address in the jit code, as an offset from the start of
+// the code, so that the code can be moved to another process.
+struct jit_relocation {
+  uint32_t offset;
+  jit_symbol symbol;
+  uint32_t index;
+};
+
 using wasm_code = std::vector<uint8_t>;
 using wasm_code_ptr = guarded_ptr<uint8_t>;
 
@@ -179,10 +203,27 @@ struct module {
   guarded_vector<uint32_t> type_aliases = {allocator, 0};
   guarded_vector<uint32_t> fast_functions = {allocator, 0};
   uint64_t maximum_stack = 0;
+  std::vector<jit_relocation> jit_relocations;
+  // Costs the code is metered with, only set while it is being compiled.
+  const gas_costs *metering = nullptr;
+  // Set if the generated code charges gas.
+  bool gas_metered = false;
+  // Set if the generated code polls the interrupt flag, see
+  // backend::polled_run. Only read by the jit.
+  bool interrupt_polled = false;
+  // The registered functions host calls dispatch to, by imported function:
+  // import_functions, unless bind_imports() selected another table.
+  const uint32_t *bound_imports = nullptr;
 
   void finalize() {
     import_functions.resize(get_imported_functions_size());
     allocator.finalize();
+    bound_imports = import_functions.raw();
+  }
+  // Dispatches host calls through @table, which has an entry for every
+  // imported function and outlives its use. nullptr selects import_functions.
+  void bind_imports(const uint32_t *table) {
+    bound_imports = table ? table : import_functions.raw();
   }
   uint32_t get_imported_functions_size() const {
     uint32_t number_of_imports = 0;
@@ -2,9 +2,12 @@
 
 #include <chrono>
 #include <condition_variable>
+#include <cstdint>
 #include <functional>
+#include <map>
 #include <mutex>
 #include <thread>
+#include <utility>
 
 namespace eosio {
 namespace vm {
@@ -79,6 +82,132 @@ private:
   std::chrono::steady_clock::duration _duration;
 };
 
+/// \brief Triggers the callbacks of many watchdogs from a single thread.
+///
+/// Timers are kept ordered by deadline, so arming and disarming one costs a
+/// tree operation instead of starting and joining a thread.
+class watchdog_service {
+public:
+  using clock = std::chrono::steady_clock;
+
+  watchdog_service() { _timer = std::thread(&watchdog_service::runner, this); }
+  ~watchdog_service() {
+    {
+      auto _lock = std::unique_lock(_mutex);
+      _stopping = true;
+    }
+    _cond.notify_one();
+    _timer.join();
+  }
+  watchdog_service(const watchdog_service &) = delete;
+  watchdog_service &operator=(const watchdog_service &) = delete;
+
+  /// Runs @callback on the timer thread at @deadline unless the returned
+  /// timer is disarmed first.
+  uint64_t arm(clock::time_point deadline, std::function<void()> callback) {
+    bool earliest;
+    uint64_t id;
+    {
+      auto _lock = std::unique_lock(_mutex);
+      id = ++_last_id;
+      auto it = _timers.emplace(key_type{deadline, id}, std::move(callback))
+                    .first;
+      earliest = it == _timers.begin();
+    }
+    if (earliest)
+      _cond.notify_one();
+    return id;
+  }
+
+  /// Cancels a timer. If its callback is running, waits for it to return,
+  /// so the callback never runs after this.
+  void disarm(clock::time_point deadline, uint64_t id) {
+    auto _lock = std::unique_lock(_mutex);
+    if (_timers.erase(key_type{deadline, id}))
+      return;
+    _done.wait(_lock, [&]() { return _running != id; });
+  }
+
+private:
+  using key_type = std::pair<clock::time_point, uint64_t>;
+
+  void runner() {
+    auto _lock = std::unique_lock(_mutex);
+    while (!_stopping) {
+      if (_timers.empty()) {
+        _cond.wait(_lock);
+        continue;
+      }
+      auto first = _timers.begin();
+      if (clock::now() < first->first.first) {
+        _cond.wait_until(_lock, first->first.first);
+        continue;
+      }
+      std::function<void()> callback = std::move(first->second);
+      _running = first->first.second;
+      _timers.erase(first);
+      _lock.unlock();
+      callback();
+      _lock.lock();
+      _running = 0;
+      _done.notify_all();
+    }
+  }
+
+  std::mutex _mutex;
+  std::condition_variable _cond;
+  std::condition_variable _done;
+  std::map<key_type, std::function<void()>> _timers;
+  uint64_t _last_id = 0;
+  // The timer whose callback is running, zero if none.
+  uint64_t _running = 0;
+  bool _stopping = false;
+  std::thread _timer;
+};
+
+/// \brief Triggers a callback after a given time elapses, like watchdog, but
+/// with the timer kept by a watchdog_service.
+class shared_watchdog {
+  class guard;
+
+public:
+  /// \tparam TimeUnits must be a chrono duration type
+  /// \pre duration must be a non-negative value.
+  template <typename TimeUnits>
+  shared_watchdog(watchdog_service &service, const TimeUnits &duration)
+      : _service(service), _duration(duration) {}
+
+  /// Starts the timer. If the timer expires during the lifetime of the
+  /// returned object, the callback will be executed on the thread of the
+  /// service.
+  template <typename F>[[nodiscard]] guard scoped_run(F &&callback) {
+    return guard(_service, watchdog_service::clock::now() + _duration,
+                 static_cast<F &&>(callback));
+  }
+
+private:
+  class guard {
+  public:
+    guard(const guard &) = delete;
+    guard &operator=(const guard &) = delete;
+
+    template <typename F>
+    guard(watchdog_service &service,
+          watchdog_service::clock::time_point deadline, F &&callback)
+        : _service(service), _deadline(deadline),
+          _id(service.arm(deadline, static_cast<F &&>(callback))) {}
+    ~guard() { _service.disarm(_deadline, _id); }
+
+  private:
+    watchdog_service &_service;
+    watchdog_service::clock::time_point _deadline;
+    uint64_t _id;
+  };
+
+  watchdog_service &_service;
+  watchdog_service::clock::duration _duration;
+};
+
 class null_watchdog {
 public:
   template <typename F> null_watchdog scoped_run(F &&) { return *this; }
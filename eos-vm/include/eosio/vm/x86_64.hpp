@@ -2,6 +2,7 @@
 
 #include <eosio/vm/allocator.hpp>
 #include <eosio/vm/exceptions.hpp>
+#include <eosio/vm/interrupt.hpp>
 #include <eosio/vm/signals.hpp>
 #include <eosio/vm/types.hpp>
 #include <eosio/vm/utils.hpp>
@@ -27,22 +28,31 @@ namespace vm {
 //
 // - The base of memory is stored in rsi
 //
+// - The context is stored in rdi.  Its first word points to the gas counter
+//   that metered code charges, and its interrupt flag follows the counter.
+//   Modules compiled with interrupt polls poll the flag at every function
+//   entry and loop head.
+//
 // - FIXME: Factor the machine instructions into a separate assembler class.
 template <typename Context> class machine_code_writer {
 public:
   machine_code_writer(growable_allocator &alloc, std::size_t source_bytes,
                       module &mod)
-      : _mod(mod), _code_segment_base(alloc.start_code()) {
-    const std::size_t code_size = 4 * 16; // 4 error handlers, each is 16 bytes.
+      : _mod(mod), _code_segment_base(alloc.start_code()),
+        _costs(mod.metering), _polled(mod.interrupt_polled) {
+    const std::size_t code_size = 6 * 16; // 6 error handlers, each is 16 bytes.
     _code_start = _mod.allocator.alloc<unsigned char>(code_size);
     _code_end = _code_start + code_size;
     code = _code_start;
 
     // always emit these functions
-    fpe_handler = emit_error_handler(&on_fp_error);
-    call_indirect_handler = emit_error_handler(&on_call_indirect_error);
-    type_error_handler = emit_error_handler(&on_type_error);
-    stack_overflow_handler = emit_error_handler(&on_stack_overflow);
+    fpe_handler = emit_error_handler(jit_symbol::on_fp_error);
+    call_indirect_handler =
+        emit_error_handler(jit_symbol::on_call_indirect_error);
+    type_error_handler = emit_error_handler(jit_symbol::on_type_error);
+    stack_overflow_handler = emit_error_handler(jit_symbol::on_stack_overflow);
+    out_of_gas_handler = emit_error_handler(jit_symbol::on_out_of_gas);
+    interrupt_handler = emit_error_handler(jit_symbol::on_interrupt);
 
     assert(code ==
            _code_end); // verify that the manual instruction count is correct
@@ -98,7 +108,10 @@ public:
   }
   ~machine_code_writer() { _mod.allocator.end_code<true>(_code_segment_base); }
 
-  static constexpr std::size_t max_prologue_size = 21;
+  static constexpr std::size_t max_gas_charge_size = 22;
+  static constexpr std::size_t max_interrupt_poll_size = 10;
+  static constexpr std::size_t max_prologue_size =
+      21 + max_interrupt_poll_size + max_gas_charge_size;
   static constexpr std::size_t max_epilogue_size = 10;
   void emit_prologue(const func_type & /*ft*/,
                      const guarded_vector<local_entry> &locals,
@@ -107,7 +120,9 @@ public:
     // FIXME: This is not a tight upper bound
     // const std::size_t instruction_size_ratio_upper_bound =
     // use_softfloat?49:79;
-    const std::size_t instruction_size_ratio_upper_bound = 79;
+    // Metering adds at most one charge per instruction.
+    const std::size_t instruction_size_ratio_upper_bound =
+        _costs ? 79 + max_gas_charge_size : 79;
     std::size_t code_size =
         max_prologue_size +
         _mod.code[funcnum].size * instruction_size_ratio_upper_bound +
@@ -120,6 +135,7 @@ public:
     emit_bytes(0x55);
     // movq RSP, RBP
     emit_bytes(0x48, 0x89, 0xe5);
+    emit_interrupt_poll();
     // No more than 2^32-1 locals.  Already validated by the parser.
     uint32_t count = 0;
     for (uint32_t i = 0; i < locals.size(); ++i) {
@@ -150,11 +166,13 @@ public:
         }
       }
     }
+    start_gas_block();
     assert((char *)code <= (char *)_code_start + max_prologue_size);
   }
   void emit_epilogue(const func_type &ft,
                      const guarded_vector<local_entry> &locals,
                      uint32_t /*funcnum*/) {
+    end_gas_block();
 #ifndef NDEBUG
     void *epilogue_start = code;
 #endif
@@ -172,15 +190,28 @@ public:
     assert((char *)code <= (char *)epilogue_start + max_epilogue_size);
   }
 
-  void emit_unreachable() { emit_error_handler(&on_unreachable); }
+  void emit_unreachable() {
+    emit_error_handler(jit_symbol::on_unreachable);
+    end_gas_block();
+  }
   void emit_nop() {}
-  void *emit_end() { return code; }
+  void *emit_end() {
+    void *result = code;
+    start_gas_block();
+    return result;
+  }
   void *emit_return(uint32_t depth_change) {
     // Return is defined as equivalent to branching to the outermost label
     return emit_br(depth_change);
   }
   void emit_block() {}
-  void *emit_loop() { return code; }
+  void *emit_loop() {
+    // Branches back to the loop land on the poll.
+    void *result = code;
+    emit_interrupt_poll();
+    start_gas_block();
+    return result;
+  }
   void *emit_if() {
     // pop RAX
     emit_bytes(0x58);
@@ -188,11 +219,14 @@ public:
     emit_bytes(0x85, 0xC0);
     // jz DEST
     emit_bytes(0x0F, 0x84);
-    return emit_branch_target32();
+    void *result = emit_branch_target32();
+    start_gas_block();
+    return result;
   }
   void *emit_else(void *if_loc) {
     void *result = emit_br(0);
     fix_branch(if_loc, code);
+    start_gas_block();
     return result;
   }
   void *emit_br(uint32_t depth_change) {
@@ -201,19 +235,22 @@ public:
     emit_multipop(depth_change);
     // jmp DEST
     emit_bytes(0xe9);
-    return emit_branch_target32();
+    void *result = emit_branch_target32();
+    end_gas_block();
+    return result;
   }
   void *emit_br_if(uint32_t depth_change) {
-    auto icount = variable_size_instr(9, 26);
+    auto icount = variable_size_instr(9, 26 + max_gas_charge_size);
     // pop RAX
     emit_bytes(0x58);
     // test EAX, EAX
     emit_bytes(0x85, 0xC0);
 
+    void *result;
     if (depth_change == 0u || depth_change == 0x80000001u) {
       // jnz DEST
       emit_bytes(0x0F, 0x85);
-      return emit_branch_target32();
+      result = emit_branch_target32();
     } else {
       // jz SKIP
       emit_bytes(0x0f, 0x84);
@@ -222,11 +259,12 @@ public:
       emit_multipop(depth_change);
       // jmp DEST
       emit_bytes(0xe9);
-      void *result = emit_branch_target32();
+      result = emit_branch_target32();
       // SKIP:
       fix_branch(skip, code);
-      return result;
     }
+    start_gas_block();
+    return result;
   }
 
   // Generate a binary search.
@@ -275,6 +313,7 @@ public:
     void *emit_default(uint32_t depth_change) {
       void *result = emit_case(depth_change);
       assert(stack.empty() && "unexpected default.");
+      _this->end_gas_block();
       return result;
     }
     machine_code_writer *_this;
@@ -451,13 +490,12 @@ public:
   void emit_get_global(uint32_t globalidx) {
     auto icount = variable_size_instr(13, 14);
     auto &gl = _mod.globals[globalidx];
-    void *ptr = &gl.current.value;
     switch (gl.type.content_type) {
     case types::i32:
     case types::f32:
       // movabsq $ptr, %rax
       emit_bytes(0x48, 0xb8);
-      emit_operand_ptr(ptr);
+      emit_symbol(jit_symbol::global, globalidx);
       // movl (%rax), eax
       emit_bytes(0x8b, 0x00);
       // push %rax
@@ -467,7 +505,7 @@ public:
     case types::f64:
       // movabsq $ptr, %rax
       emit_bytes(0x48, 0xb8);
-      emit_operand_ptr(ptr);
+      emit_symbol(jit_symbol::global, globalidx);
       // movl (%rax), %rax
       emit_bytes(0x48, 0x8b, 0x00);
       // push %rax
@@ -476,13 +514,11 @@ public:
     }
   }
   void emit_set_global(uint32_t globalidx) {
-    auto &gl = _mod.globals[globalidx];
-    void *ptr = &gl.current.value;
     // popq %rcx
     emit_bytes(0x59);
     // movabsq $ptr, %rax
     emit_bytes(0x48, 0xb8);
-    emit_operand_ptr(ptr);
+    emit_symbol(jit_symbol::global, globalidx);
     // movq %rcx, (%rax)
     emit_bytes(0x48, 0x89, 0x08);
   }
@@ -625,7 +661,7 @@ public:
     emit_bytes(0x56);
     // movabsq $current_memory, %rax
     emit_bytes(0x48, 0xb8);
-    emit_operand_ptr(&current_memory);
+    emit_symbol(jit_symbol::current_memory);
     // call *%rax
     emit_bytes(0xff, 0xd0);
     // pop %rsi
@@ -646,7 +682,7 @@ public:
     emit_bytes(0x48, 0x89, 0xc6);
     // movabsq $grow_memory, %rax
     emit_bytes(0x48, 0xb8);
-    emit_operand_ptr(&grow_memory);
+    emit_symbol(jit_symbol::grow_memory);
     // call *%rax
     emit_bytes(0xff, 0xd0);
     // pop %rsi
@@ -1630,6 +1666,13 @@ public:
 
   void emit_error() { unimplemented(); }
 
+  // Adds the cost of the next instruction to the charge of the straight-line
+  // code it belongs to.
+  void charge_instruction(uint8_t opcode) {
+    if (_costs)
+      _gas_cost += _costs->opcodes[opcode];
+  }
+
   // --------------- random  ------------------------
   static void fix_branch(void *branch, void *target) {
     auto branch_ = static_cast<uint8_t *>(branch);
@@ -1647,6 +1690,36 @@ public:
     memcpy(branch, &target, 8);
   }
 
+  // Returns the runtime address of a symbol in the code generated for @mod.
+  static void *symbol_address(module &mod, jit_symbol sym, uint32_t index) {
+    switch (sym) {
+    case jit_symbol::global:
+      return &mod.globals.at(index).current.value;
+    case jit_symbol::current_memory:
+      return reinterpret_cast<void *>(&current_memory);
+    case jit_symbol::grow_memory:
+      return reinterpret_cast<void *>(&grow_memory);
+    case jit_symbol::call_host_function:
+      return reinterpret_cast<void *>(&call_host_function);
+    case jit_symbol::on_unreachable:
+      return reinterpret_cast<void *>(&on_unreachable);
+    case jit_symbol::on_fp_error:
+      return reinterpret_cast<void *>(&on_fp_error);
+    case jit_symbol::on_call_indirect_error:
+      return reinterpret_cast<void *>(&on_call_indirect_error);
+    case jit_symbol::on_type_error:
+      return reinterpret_cast<void *>(&on_type_error);
+    case jit_symbol::on_stack_overflow:
+      return reinterpret_cast<void *>(&on_stack_overflow);
+    case jit_symbol::on_out_of_gas:
+      return reinterpret_cast<void *>(&on_out_of_gas);
+    case jit_symbol::on_interrupt:
+      return reinterpret_cast<void *>(&on_interrupt);
+    }
+    EOS_VM_ASSERT(false, wasm_parse_exception, "unknown jit symbol");
+    __builtin_unreachable();
+  }
+
   using fn_type = native_value (*)(void *context, void *memory);
   void finalize(function_body &body) {
     _mod.allocator.reclaim(code, _code_end - code);
@@ -1682,9 +1755,20 @@ private:
   void *call_indirect_handler;
   void *type_error_handler;
   void *stack_overflow_handler;
+  void *out_of_gas_handler;
+  void *interrupt_handler;
   void *jmp_table;
   uint32_t _local_count;
   uint32_t _table_element_size;
+  // Set when the module is metered.
+  const gas_costs *_costs;
+  // Set when the module polls the interrupt flag.
+  bool _polled;
+  // The charge of the current straight-line code and the sum of the costs of
+  // its instructions so far. Code after an unconditional branch is never
+  // reached, so it has no charge.
+  unsigned char *_gas_charge = nullptr;
+  uint64_t _gas_cost = 0;
 
   void emit_byte(uint8_t val) { *code++ = val; }
   void emit_bytes() {}
@@ -1712,6 +1796,14 @@ private:
     memcpy(code, &val, sizeof(val));
     code += sizeof(val);
   }
+  // Emits the address of a symbol and records where it is, so that a copy of
+  // the code can be relocated.
+  void emit_symbol(jit_symbol sym, uint32_t index = 0) {
+    _mod.jit_relocations.push_back(
+        {static_cast<uint32_t>(code - (unsigned char *)_code_segment_base),
+         sym, index});
+    emit_operand_ptr(symbol_address(_mod, sym, index));
+  }
 
   void *emit_branch_target32() {
     void *result = code;
@@ -1732,6 +1824,52 @@ private:
     emit_bytes(0xff, 0xc3);
   }
 
+  // Starts the next piece of straight-line code with a charge for its
+  // instructions, which is filled in once they are known.
+  void start_gas_block() {
+    if (!_costs)
+      return;
+    end_gas_block();
+    _gas_charge = code;
+    // mov (%rdi), %rax
+    emit_bytes(0x48, 0x8b, 0x07);
+    // movabsq $cost, %rcx
+    emit_bytes(0x48, 0xb9);
+    emit_operand64(0);
+    // subq %rcx, (%rax)
+    emit_bytes(0x48, 0x29, 0x08);
+    // js out_of_gas
+    emit_bytes(0x0f, 0x88);
+    fix_branch(emit_branch_target32(), out_of_gas_handler);
+    assert(code == _gas_charge + max_gas_charge_size);
+  }
+  // Traps if the interrupt flag of the context is set, in modules that poll
+  // it.
+  void emit_interrupt_poll() {
+    if (!_polled)
+      return;
+    [[maybe_unused]] void *poll = code;
+    // cmpl $0, interrupt_flag_offset(%rdi)
+    emit_bytes(0x83, 0x7f, interrupt_flag_offset, 0x00);
+    // jne interrupt
+    emit_bytes(0x0f, 0x85);
+    fix_branch(emit_branch_target32(), interrupt_handler);
+    assert(code == (unsigned char *)poll + max_interrupt_poll_size);
+  }
+  void end_gas_block() {
+    if (_gas_charge) {
+      if (_gas_cost == 0) {
+        // jmp past the charge
+        _gas_charge[0] = 0xeb;
+        _gas_charge[1] = max_gas_charge_size - 2;
+      } else {
+        memcpy(_gas_charge + 5, &_gas_cost, sizeof(_gas_cost));
+      }
+    }
+    _gas_charge = nullptr;
+    _gas_cost = 0;
+  }
+
   static void unimplemented() {
     EOS_VM_ASSERT(false, wasm_parse_exception, "Sorry, not implemented.");
   }
@@ -1958,13 +2096,13 @@ private:
     fix_branch(emit_branch_target32(), fpe_handler);
   }
 
-  void *emit_error_handler(void (*handler)()) {
+  void *emit_error_handler(jit_symbol handler) {
     void *result = code;
     // andq $-16, %rsp;
     emit_bytes(0x48, 0x83, 0xe4, 0xf0);
     // movabsq &on_unreachable, %rax
     emit_bytes(0x48, 0xb8);
-    emit_operand_ptr(handler);
+    emit_symbol(handler);
     // callq *%rax
     emit_bytes(0xff, 0xd0);
     return result;
@@ -1996,7 +2134,7 @@ private:
     emit_align_stack();
     // movabsq $call_host_function, %rax
     emit_bytes(0x48, 0xb8);
-    emit_operand_ptr(&call_host_function);
+    emit_symbol(jit_symbol::call_host_function);
     // callq *%rax
     emit_bytes(0xff, 0xd0);
     emit_restore_stack();
@@ -2047,6 +2185,14 @@ private:
   static void on_stack_overflow() {
     vm::throw_<wasm_interpreter_exception>("stack overflow");
   }
+  static void on_out_of_gas() {
+    vm::throw_<out_of_gas_exception>("out of gas");
+  }
+  // The flag is cleared first, so the context can run code again.
+  static void on_interrupt(Context *context /*rdi*/) {
+    context->clear_interrupt();
+    vm::throw_<interrupt_exception>("interrupted");
+  }
 };
 
 } // namespace vm
@@ -26,6 +26,71 @@ extern "C" {
 
 EVMC_EXPORT evmc_vm *evmc_create_athena(void) noexcept;
 
+/// Executes @p msg as a static call, which cannot change state.
+///
+/// Unlike execute(), many threads may execute static calls at once against
+/// the same host, which is only asked to read state, and only by one of them
+/// at a time unless the "static:serialize" option is "false". Calls against
+/// different host contexts do not wait for each other. Code compiled for one
+/// call is shared with the others. Calls the executed code makes reach the
+/// host from any of those threads, and are expected to be executed with
+/// athena_execute_static() as well.
+EVMC_EXPORT struct evmc_result athena_execute_static(
+    struct evmc_vm *vm, const struct evmc_host_interface *host,
+    struct evmc_host_context *context, enum evmc_revision rev,
+    const struct evmc_message *msg, const uint8_t *code,
+    size_t code_size) noexcept;
+
+/// A top-level message of a batch, the code it executes and the host context
+/// of its transaction.
+struct athena_batch_message {
+  const struct evmc_message *msg;
+  const uint8_t *code;
+  size_t code_size;
+  struct evmc_host_context *context;
+};
+
+/// Executes the messages of a block in parallel, with the results and state
+/// changes of executing them one after another with execute().
+///
+/// Every message is first executed speculatively on a worker thread against
+/// the state before the batch, with its storage changes and logs held back.
+/// They are then committed in order, and a message that read storage an
+/// earlier one changed is executed again before it is committed. Each message
+/// queries its own host context, which gives it its transaction context. The
+/// hosts have to answer queries from many threads at once until this
+/// returns. The context of a committed message gets its changes as stores and
+/// logs made in the same order as the execution made them.
+///
+/// Calls, creates, selfdestructs and value transfers need the client, so the
+/// batch stops at the first message that makes one. The client charges the
+/// senders for gas and pays the coinbase between messages, which the batch
+/// does not see, so it also stops at the first message that reads the
+/// existence, balance or code of a sender, origin or coinbase of the batch.
+/// The client then settles the fees of the executed messages, executes the
+/// message it stopped at with execute() and passes the rest in a new batch.
+///
+/// @returns the number of leading messages executed, whose results are
+/// stored in @p results and have to be released by the caller.
+EVMC_EXPORT size_t athena_execute_batch(
+    struct evmc_vm *vm, const struct evmc_host_interface *host,
+    enum evmc_revision rev, const struct athena_batch_message *messages,
+    size_t count, struct evmc_result *results) noexcept;
+
+/// Counters of a cache of an instance.
+struct athena_cache_stats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+};
+
+/// Reads the counters of the @p cache of @p vm, which is one of the caches
+/// with a budget option: "evm2wasm" or "sentinel".
+///
+/// @returns false if there is no such cache.
+EVMC_EXPORT bool athena_get_cache_stats(struct evmc_vm *vm, const char *cache,
+                                        struct athena_cache_stats *stats) noexcept;
+
 #if __cplusplus
 }
 #endif
@@ -16,21 +16,39 @@
 
 #include <athena/athena.h>
 
+#include <algorithm>
+#include <array>
+#include <condition_variable>
 #include <csignal>
 #include <cstring>
 //#include <execinfo.h>
+#include <iomanip>
 #include <iostream>
 #include <limits>
+#include <atomic>
+#include <chrono>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <sys/stat.h>
+#include <thread>
 #include <unistd.h>
+#include <unordered_map>
+#include <vector>
 
 #include <evmc/evmc.h>
 
 #include "debugging.h"
 #include "eei.h"
+#include "cache.h"
 #include "exceptions.h"
 #include "helpers.h"
+#include "host_cache.h"
+#include "overlay_host.h"
+#include "read_only_host.h"
+#include "worker_pool.h"
 #if H_EOS
 #include "eosvm.h"
 #endif
@@ -70,7 +88,7 @@ const map<string, WasmEngineCreateFn> wasm_engine_map {
 #endif
 };
 
-WasmEngineCreateFn wasmEngineCreateFn =
+const WasmEngineCreateFn defaultWasmEngineCreateFn =
 // This is the order of preference.
 #if H_WABT
     WabtEngine::create
@@ -81,16 +99,221 @@ WasmEngineCreateFn wasmEngineCreateFn =
 #endif
     ;
 
+// Identifies an instance together with the options its engines were created
+// with, so a thread notices when its engine is stale.
+atomic<uint64_t> lastEngineGeneration{0};
+
+InstructionCosts uniformCosts(uint32_t cost) {
+  InstructionCosts costs;
+  costs.fill(cost);
+  return costs;
+}
+
+// State of one thread executing on an instance.
+struct athena_thread_state {
+  unique_ptr<WasmEngine> engine;
+  // Host queries answered during the outermost frame this thread executes,
+  // shared by the frames nested in it.
+  HostCache hostCache;
+  // Frames this thread is executing, one for the outermost.
+  unsigned frames = 0;
+};
+
+// Keeps the host cache of a thread for as long as its outermost frame
+// executes.
+class HostCacheScope {
+public:
+  explicit HostCacheScope(athena_thread_state &state) noexcept
+      : m_state(state) {
+    if (m_state.frames++ == 0)
+      m_state.hostCache.clear();
+  }
+
+  ~HostCacheScope() {
+    if (--m_state.frames == 0)
+      m_state.hostCache.clear();
+  }
+
+  HostCacheScope(HostCacheScope const &) = delete;
+  HostCacheScope &operator=(HostCacheScope const &) = delete;
+
+private:
+  athena_thread_state &m_state;
+};
+
+// States of the threads executing on an instance, by thread.
+struct ThreadStates {
+  mutex lock;
+  unordered_map<thread::id, unique_ptr<athena_thread_state>> states;
+};
+
+// Drops the states a thread created on any instance when the thread exits,
+// so a pool of threads that come and go does not pile up engines. Instances
+// destroyed before are skipped.
+class ThreadExit {
+public:
+  ~ThreadExit() {
+    // The state is destroyed under the lock, so the instance cannot be
+    // destroyed while its engine is.
+    for (auto const &registered : m_instances) {
+      if (auto instance = registered.lock()) {
+        lock_guard<mutex> lock(instance->lock);
+        instance->states.erase(this_thread::get_id());
+      }
+    }
+  }
+
+  void add(shared_ptr<ThreadStates> const &instance) {
+    for (auto it = m_instances.begin(); it != m_instances.end();)
+      it = it->expired() ? m_instances.erase(it) : next(it);
+    m_instances.insert(instance);
+  }
+
+private:
+  set<weak_ptr<ThreadStates>, owner_less<weak_ptr<ThreadStates>>> m_instances;
+};
+
+// Output of a system contract for some code, and the digest of the contract
+// that made it, see systemContractDigest(). Output of another contract is
+// stale.
+struct Translation {
+  uint64_t translator;
+  bytes output;
+};
+
+// An instance may execute on any number of threads at once. Each thread gets
+// an engine of its own, while the options are only changed by set_option()
+// when nothing executes.
 struct athena_instance : evmc_vm {
-  unique_ptr<WasmEngine> engine = wasmEngineCreateFn();
+  WasmEngineCreateFn wasmEngineCreateFn = defaultWasmEngineCreateFn;
   athena_evm1mode evm1mode = athena_evm1mode::reject;
   bool metering = false;
+  // Have the engine charge gas for the instructions of wasm contracts instead
+  // of metering them with the Sentinel contract.
+  bool nativeMetering = false;
+  // Gas native metering charges for each instruction.
+  InstructionCosts instructionCosts = uniformCosts(1);
+  bool benchmarking = false;
   map<evmc::address, bytes> contract_preload_list;
+  // Memory each engine may keep compiled modules in between executions.
+  size_t moduleCacheBudget = 64 * 1024 * 1024;
+  // Directory translations and compiled code are spilled to, so they outlive
+  // the process.
+  string cacheDir;
+  // Executions after which code is compiled in the background, zero to
+  // compile all code up front.
+  uint32_t tierThreshold = 0;
+  unsigned tierThreads = 1;
+  // Wall-clock milliseconds the code of a call may run, zero for no limit.
+  uint32_t timeLimit = 0;
+  // Threads batches speculate on, zero for one per core.
+  unsigned batchThreads = 0;
+
+  // Shared by all threads and guarded by cacheLock.
+  mutex cacheLock;
+  // EVM1 code translated by evm2wasm.
+  CodeCache<Translation> evm2wasmCache{16 * 1024 * 1024};
+  // Wasm code metered by the Sentinel contract.
+  CodeCache<Translation> sentinelCache{16 * 1024 * 1024};
+  // Interpreter generated by the loaded runevm contract, empty until needed.
+  bytes runevmOutput;
+
+  // Code compiled by the engine of one thread, for the engines of the others.
+  CompiledCodeCache compiledCode{64 * 1024 * 1024};
+  // Held while a static call queries the client host, one per host context,
+  // so static calls against different hosts do not wait for each other.
+  // Contexts whose hashes collide share a lock.
+  array<mutex, 64> staticHostLocks;
+  // Cleared by clients whose host answers queries from many threads at once.
+  bool serializeStaticHost = true;
 
   athena_instance() noexcept
       : evmc_vm({EVMC_ABI_VERSION, "athena",
                  athena_get_buildinfo()->project_version, nullptr, nullptr,
                  nullptr, nullptr}) {}
+
+  // The engines use the caches of the instance, so they go first, even if an
+  // exiting thread keeps the states of the threads alive a little longer.
+  ~athena_instance() {
+    lock_guard<mutex> lock(threads->lock);
+    threads->states.clear();
+  }
+
+  // Returns the lock static calls query the host of @context with, or null if
+  // they need none.
+  mutex *staticHostLock(evmc_host_context *context) noexcept {
+    if (!serializeStaticHost)
+      return nullptr;
+    const uintptr_t key = reinterpret_cast<uintptr_t>(context);
+    return &staticHostLocks[key / alignof(max_align_t) %
+                            staticHostLocks.size()];
+  }
+
+  // Returns the state of the calling thread, creating it on its first
+  // execution.
+  athena_thread_state &threadState() {
+    // The state of the instance the thread ran on last.
+    thread_local uint64_t lastGeneration = 0;
+    thread_local athena_thread_state *lastState = nullptr;
+    if (lastGeneration == generation)
+      return *lastState;
+
+    thread_local ThreadExit threadExit;
+    lock_guard<mutex> lock(threads->lock);
+    auto &state = threads->states[this_thread::get_id()];
+    if (!state) {
+      state = make_unique<athena_thread_state>();
+      state->engine = createEngine();
+      threadExit.add(threads);
+    }
+    lastGeneration = generation;
+    lastState = state.get();
+    return *state;
+  }
+
+  // Returns a new engine configured with the engine options.
+  unique_ptr<WasmEngine> createEngine() {
+    unique_ptr<WasmEngine> engine = wasmEngineCreateFn();
+    engine->setModuleCacheBudget(moduleCacheBudget);
+    engine->setInstructionCosts(instructionCosts);
+    engine->setCompiledCodeCache(&compiledCode);
+    engine->setCacheDirectory(cacheDir);
+    engine->setTiering(tierThreshold, tierThreads);
+    engine->setTimeLimit(chrono::milliseconds(timeLimit));
+    engine->setBenchmarking(benchmarking);
+    return engine;
+  }
+
+  // Drops the engines of all threads after the engine options changed.
+  void resetEngines() {
+    lock_guard<mutex> lock(threads->lock);
+    threads->states.clear();
+    generation = ++lastEngineGeneration;
+  }
+
+  // Returns the threads batches speculate on, starting them on first use.
+  WorkerPool &batchWorkers() {
+    lock_guard<mutex> lock(batchLock);
+    if (!batchPool) {
+      const unsigned threads =
+          batchThreads ? batchThreads : max(thread::hardware_concurrency(), 1u);
+      batchPool = make_unique<WorkerPool>(threads);
+    }
+    return *batchPool;
+  }
+
+  void setBatchThreads(unsigned threads) {
+    lock_guard<mutex> lock(batchLock);
+    batchThreads = threads;
+    batchPool.reset();
+  }
+
+private:
+  uint64_t generation = ++lastEngineGeneration;
+  // Shared with the threads, which may exit after the instance is destroyed.
+  shared_ptr<ThreadStates> threads = make_shared<ThreadStates>();
+  mutex batchLock;
+  unique_ptr<WorkerPool> batchPool;
 };
 
 using namespace evmc::literals;
@@ -103,10 +326,9 @@ const auto runevmAddress = 0x000000000000000000000000000000000000000c_address;
 // It is a "staticcall" with sender 000...000 and no value.
 // @returns output data from the contract and update the @gas variable with the
 // gas left.
-pair<evmc_status_code, bytes> callSystemContract(evmc::HostContext &context,
-                                                 evmc_address const &address,
-                                                 int64_t &gas,
-                                                 bytes_view input) {
+pair<evmc_status_code, bytes>
+callSystemContract(evmc::HostInterface &context, evmc_address const &address,
+                   int64_t &gas, bytes_view input) {
   evmc_message message = {
       .kind = EVMC_CALL,
       .flags = EVMC_STATIC,
@@ -132,8 +354,9 @@ pair<evmc_status_code, bytes> callSystemContract(evmc::HostContext &context,
 }
 
 pair<evmc_status_code, bytes> locallyExecuteSystemContract(
-    evmc::HostContext &context, evmc_address const &address, int64_t &gas,
-    bytes_view input, bytes_view code, bytes_view state_code) {
+    athena_instance const &athena, evmc::HostInterface &context,
+    evmc_address const &address, int64_t &gas, bytes_view input,
+    bytes_view code, bytes_view state_code) {
   const evmc_message message = {
       .kind = EVMC_CALL,
       .flags = EVMC_STATIC,
@@ -147,10 +370,10 @@ pair<evmc_status_code, bytes> locallyExecuteSystemContract(
       .create2_salt = {},
   };
 
-  unique_ptr<WasmEngine> engine = wasmEngineCreateFn();
+  unique_ptr<WasmEngine> engine = athena.wasmEngineCreateFn();
   // TODO: should we catch exceptions here?
   ExecutionResult result =
-      engine->execute(context, code, state_code, message, false);
+      engine->execute(context, code, state_code, message, false, false);
 
   bytes ret;
   evmc_status_code status = result.isRevert ? EVMC_REVERT : EVMC_SUCCESS;
@@ -162,7 +385,7 @@ pair<evmc_status_code, bytes> locallyExecuteSystemContract(
 
 // Calls the Sentinel contract with input data @input.
 // @returns the validated and metered output or empty output otherwise.
-bytes sentinel(evmc::HostContext &context, bytes_view input) {
+bytes sentinel(evmc::HostInterface &context, bytes_view input) {
 #if H_DEBUGGING
   H_DEBUG << "Metering (input " << input.size() << " bytes)...\n";
 #endif
@@ -187,9 +410,42 @@ bytes sentinel(evmc::HostContext &context, bytes_view input) {
   return ret;
 }
 
+// Returns a digest of the system contract at @address: the overriding one if
+// it is loaded, or the one in the state otherwise.
+uint64_t systemContractDigest(athena_instance const &athena,
+                              evmc::HostInterface &context,
+                              evmc::address const &address) {
+  auto preload = athena.contract_preload_list.find(address);
+  if (preload != athena.contract_preload_list.end())
+    return codeDigest(preload->second);
+  const evmc::bytes32 hash = context.get_code_hash(address);
+  return codeDigest(bytes_view{hash.bytes, sizeof(hash.bytes)});
+}
+
+// Meters @code with the Sentinel contract, unless the current Sentinel
+// contract metered it before.
+bytes cachedSentinel(athena_instance &athena, evmc::HostInterface &context,
+                     bytes_view code) {
+  const uint64_t translator =
+      systemContractDigest(athena, context, sentinelAddress);
+  {
+    lock_guard<mutex> lock(athena.cacheLock);
+    auto cached = athena.sentinelCache.get(code);
+    if (cached && cached->translator == translator)
+      return move(cached->output);
+  }
+
+  // The lock is not held across the call, which may execute on this instance
+  // again.
+  bytes ret = sentinel(context, code);
+  lock_guard<mutex> lock(athena.cacheLock);
+  athena.sentinelCache.put({bytes{code}, {translator, ret}, ret.size()});
+  return ret;
+}
+
 // Calls the evm2wasm contract with input data @input.
 // @returns the compiled output or empty output otherwise.
-bytes evm2wasm(evmc::HostContext &context, bytes_view input) {
+bytes evm2wasm(evmc::HostInterface &context, bytes_view input) {
   H_DEBUG << "Calling evm2wasm (input " << input.size() << " bytes)...\n";
 
   int64_t startgas =
@@ -210,9 +466,91 @@ bytes evm2wasm(evmc::HostContext &context, bytes_view input) {
   return ret;
 }
 
+// Returns the file a translation of @code by the evm2wasm contract with digest
+// @translator is spilled to, so translations of another one are not reused.
+string evm2wasmSpillPath(athena_instance const &athena, bytes_view code,
+                         uint64_t translator) {
+  ostringstream os;
+  os << athena.cacheDir << "/" << hex << setfill('0') << setw(16)
+     << codeDigest(code) << "-" << setw(16) << translator << ".evm2wasm";
+  return os.str();
+}
+
+// Spilled translations start with the size of the EVM1 code they were made
+// from, the size of the translated module and a digest of it, followed by the
+// code and the module. A file that is truncated or corrupt does not match and
+// the code is translated again.
+struct SpilledEvm2wasmHeader {
+  uint64_t codeSize;
+  uint64_t outputSize;
+  uint64_t outputDigest;
+};
+
+bool loadSpilledEvm2wasm(athena_instance const &athena, bytes_view code,
+                         uint64_t translator, bytes &output) {
+  bytes contents =
+      loadFileContents(evm2wasmSpillPath(athena, code, translator));
+  SpilledEvm2wasmHeader header;
+  if (contents.size() < sizeof(header))
+    return false;
+  memcpy(&header, contents.data(), sizeof(header));
+  bytes_view rest = bytes_view{contents}.substr(sizeof(header));
+  if (header.codeSize != code.size() || rest.size() < code.size() ||
+      header.outputSize != rest.size() - code.size() ||
+      rest.substr(0, code.size()) != code)
+    return false;
+  bytes_view spilled = rest.substr(code.size());
+  if (codeDigest(spilled) != header.outputDigest)
+    return false;
+  output = spilled;
+  return true;
+}
+
+void spillEvm2wasm(athena_instance const &athena, bytes_view code,
+                   uint64_t translator, bytes_view output) {
+  const SpilledEvm2wasmHeader header{code.size(), output.size(),
+                                     codeDigest(output)};
+  bytes contents(reinterpret_cast<uint8_t const *>(&header), sizeof(header));
+  contents.append(code).append(output);
+  if (!storeFileContents(evm2wasmSpillPath(athena, code, translator),
+                         contents))
+    H_DEBUG << "Failed to spill evm2wasm output to " << athena.cacheDir
+            << "\n";
+}
+
+// Translates @code with evm2wasm, unless the current evm2wasm contract
+// translated it before.
+bytes cachedEvm2wasm(athena_instance &athena, evmc::HostInterface &context,
+                     bytes_view code) {
+  const uint64_t translator =
+      systemContractDigest(athena, context, evm2wasmAddress);
+  {
+    lock_guard<mutex> lock(athena.cacheLock);
+    auto cached = athena.evm2wasmCache.get(code);
+    if (cached && cached->translator == translator) {
+      H_DEBUG << "Using cached evm2wasm output (" << cached->output.size()
+              << " bytes)\n";
+      return move(cached->output);
+    }
+  }
+
+  bytes ret;
+  if (athena.cacheDir.empty() ||
+      !loadSpilledEvm2wasm(athena, code, translator, ret)) {
+    ret = evm2wasm(context, code);
+    if (!athena.cacheDir.empty())
+      spillEvm2wasm(athena, code, translator, ret);
+  }
+
+  lock_guard<mutex> lock(athena.cacheLock);
+  athena.evm2wasmCache.put({bytes{code}, {translator, ret}, ret.size()});
+  return ret;
+}
+
 // Calls the runevm contract.
 // @returns a wasm-based evm interpreter.
-bytes runevm(evmc::HostContext &context, bytes code) {
+bytes runevm(athena_instance const &athena, evmc::HostInterface &context,
+             bytes_view code) {
   H_DEBUG << "Calling runevm (code " << code.size() << " bytes)...\n";
 
   int64_t gas = numeric_limits<int64_t>::max(); // do not charge for metering
@@ -220,8 +558,8 @@ bytes runevm(evmc::HostContext &context, bytes code) {
   evmc_status_code status;
   bytes ret;
 
-  tie(status, ret) =
-      locallyExecuteSystemContract(context, runevmAddress, gas, {}, code, code);
+  tie(status, ret) = locallyExecuteSystemContract(athena, context, runevmAddress,
+                                                  gas, {}, code, code);
 
   H_DEBUG << "runevm done (output " << ret.size()
           << " bytes) with status=" << status << "\n";
@@ -236,18 +574,38 @@ bytes runevm(evmc::HostContext &context, bytes code) {
   return ret;
 }
 
+// Returns the interpreter generated by the loaded runevm contract. It is the
+// same for every call, so its compiled form is also found in the module cache.
+bytes cachedRunevm(athena_instance &athena, evmc::HostInterface &context) {
+  {
+    lock_guard<mutex> lock(athena.cacheLock);
+    if (!athena.runevmOutput.empty())
+      return athena.runevmOutput;
+  }
+
+  // The lock is not held while runevm executes, which may reach the host and
+  // execute on this instance again. Threads that miss at once each generate
+  // the same interpreter.
+  auto preload = athena.contract_preload_list.find(runevmAddress);
+  athenaAssert(preload != athena.contract_preload_list.end(),
+               "runevm contract not loaded.");
+  bytes ret = runevm(athena, context, preload->second);
+  lock_guard<mutex> lock(athena.cacheLock);
+  if (athena.runevmOutput.empty())
+    athena.runevmOutput = ret;
+  return ret;
+}
+
 void athena_destroy_result(evmc_result const *result) noexcept {
   delete[] result->output_data;
 }
 
-evmc_result athena_execute(evmc_vm *instance,
-                           const evmc_host_interface *host_interface,
-                           evmc_host_context *context, enum evmc_revision rev,
-                           const evmc_message *msg, const uint8_t *code,
-                           size_t code_size) noexcept {
-  athena_instance *athena = static_cast<athena_instance *>(instance);
-  evmc::HostContext host{*host_interface, context};
-
+// Executes @msg with the engine of @state, which belongs to the calling
+// thread.
+evmc_result execute(athena_instance *athena, athena_thread_state &state,
+                    evmc::HostInterface &host, enum evmc_revision rev,
+                    const evmc_message *msg, const uint8_t *code,
+                    size_t code_size) noexcept {
 #if H_DEBUGGING
   H_DEBUG << "Executing message in Athena\n";
 #endif
@@ -284,7 +642,7 @@ evmc_result athena_execute(evmc_vm *instance,
     if (!isWasm) {
       switch (athena->evm1mode) {
       case athena_evm1mode::evm2wasm_contract:
-        run_code = evm2wasm(host, run_code);
+        run_code = cachedEvm2wasm(*athena, host, run_code);
         ensureCondition(run_code.size() > 8, ContractValidationFailure,
                         "Transcompiling via evm2wasm failed");
         // TODO: enable this once evm2wasm does metering of interfaces
@@ -300,7 +658,7 @@ evmc_result athena_execute(evmc_vm *instance,
         ret.status_code = EVMC_FAILURE;
         return ret;
       case athena_evm1mode::runevm_contract:
-        run_code = runevm(host, athena->contract_preload_list[runevmAddress]);
+        run_code = cachedRunevm(*athena, host);
         ensureCondition(run_code.size() > 8, ContractValidationFailure,
                         "Interpreting via runevm failed");
         // Runevm does interface metering on its own
@@ -316,14 +674,14 @@ evmc_result athena_execute(evmc_vm *instance,
     if (msg->kind == EVMC_CREATE && isWasm) {
       // Meter the deployment (constructor) code if it is WebAssembly
       if (athena->metering)
-        run_code = sentinel(host, run_code);
+        run_code = cachedSentinel(*athena, host, run_code);
       ensureCondition(hasWasmPreamble(run_code) && hasWasmVersion(run_code, 1),
                       ContractValidationFailure,
                       "Invalid contract or metering failed.");
     }
 
-    athenaAssert(athena->engine, "Wasm engine not set.");
-    WasmEngine &engine = *athena->engine;
+    athenaAssert(state.engine, "Wasm engine not set.");
+    WasmEngine &engine = *state.engine;
 
     ExecutionResult result;
     // should move after execution if want remember owner's address
@@ -334,8 +692,10 @@ evmc_result athena_execute(evmc_vm *instance,
       result.isRevert = false;
       result.returnValue = run_code;
     } else {
-      result =
-          engine.execute(host, run_code, state_code, *msg, meterInterfaceGas);
+      // Code generated by evm2wasm and runevm charges gas on its own.
+      const bool meterInstructions = athena->nativeMetering && isWasm;
+      result = engine.execute(host, run_code, state_code, *msg,
+                              meterInterfaceGas, meterInstructions);
       athenaAssert(result.gasLeft >= 0, "Negative gas left after execution.");
     }
 
@@ -350,8 +710,9 @@ evmc_result athena_execute(evmc_vm *instance,
                         "Contract has an invalid WebAssembly version.");
 
         // Meter the deployed code if it is WebAssembly
-        returnValue = athena->metering ? sentinel(host, result.returnValue)
-                                       : move(result.returnValue);
+        returnValue = athena->metering
+                          ? cachedSentinel(*athena, host, result.returnValue)
+                          : move(result.returnValue);
         ensureCondition(
             hasWasmPreamble(returnValue) && hasWasmVersion(returnValue, 1),
             ContractValidationFailure, "Invalid contract or metering failed.");
@@ -410,6 +771,88 @@ evmc_result athena_execute(evmc_vm *instance,
   return ret;
 }
 
+evmc_result athena_execute(evmc_vm *instance,
+                           const evmc_host_interface *host_interface,
+                           evmc_host_context *context, enum evmc_revision rev,
+                           const evmc_message *msg, const uint8_t *code,
+                           size_t code_size) noexcept {
+  athena_instance *athena = static_cast<athena_instance *>(instance);
+  athena_thread_state &state = athena->threadState();
+  // The depth of the message does not tell whether it starts a transaction,
+  // as the client may have executed the frames above it.
+  HostCacheScope scope{state};
+  CachingHost host{*host_interface, context, state.hostCache};
+
+  evmc_result ret = execute(athena, state, host, rev, msg, code, code_size);
+
+  // The state changes of this frame are undone, including created accounts.
+  if (ret.status_code != EVMC_SUCCESS)
+    state.hostCache.clearAccounts();
+
+  return ret;
+}
+
+// Speculative execution of a message of a batch.
+struct Speculation {
+  // The host context of the message, which carries its transaction context.
+  evmc::HostContext base;
+  OverlayHost overlay{base};
+  evmc_result result{};
+
+  Speculation(evmc_host_interface const &interface,
+              evmc_host_context *context) noexcept
+      : base(interface, context) {}
+
+  ~Speculation() {
+    if (result.release)
+      result.release(&result);
+  }
+
+  Speculation(Speculation const &) = delete;
+  Speculation &operator=(Speculation const &) = delete;
+
+  // Hands the result over to the caller.
+  evmc_result take() noexcept {
+    evmc_result taken = result;
+    result = evmc_result{};
+    return taken;
+  }
+};
+
+// Executes @messages in parallel, each against the state as it is before any
+// of them.
+vector<unique_ptr<Speculation>>
+speculate(athena_instance *athena, evmc_host_interface const &interface,
+          enum evmc_revision rev, athena_batch_message const *messages,
+          size_t count) {
+  vector<unique_ptr<Speculation>> speculations;
+  speculations.reserve(count);
+  for (size_t i = 0; i < count; i++)
+    speculations.push_back(
+        make_unique<Speculation>(interface, messages[i].context));
+
+  mutex doneLock;
+  condition_variable done;
+  size_t pending = count;
+  WorkerPool &workers = athena->batchWorkers();
+  for (size_t i = 0; i < count; i++) {
+    workers.submit([&, i]() {
+      Speculation &speculation = *speculations[i];
+      athena_batch_message const &message = messages[i];
+      speculation.result =
+          execute(athena, athena->threadState(), speculation.overlay, rev,
+                  message.msg, message.code, message.code_size);
+      lock_guard<mutex> lock(doneLock);
+      if (--pending == 0)
+        done.notify_one();
+    });
+  }
+
+  unique_lock<mutex> lock(doneLock);
+  done.wait(lock, [&]() { return pending == 0; });
+  return speculations;
+}
+
 bool athena_parse_sys_option(athena_instance *athena, string const &_name,
                              string const &value) {
   athenaAssert(_name.find("sys:") == 0, "");
@@ -455,10 +898,83 @@ bool athena_parse_sys_option(athena_instance *athena, string const &_name,
           << contents.size() << " bytes)\n";
 
   athena->contract_preload_list[address] = move(contents);
+  // Output of the previous system contract is stale.
+  lock_guard<mutex> lock(athena->cacheLock);
+  if (address == sentinelAddress)
+    athena->sentinelCache.clear();
+  if (address == evm2wasmAddress)
+    athena->evm2wasmCache.clear();
+  if (address == runevmAddress)
+    athena->runevmOutput.clear();
 
   return true;
 }
 
+bool athena_parse_cache_option(athena_instance *athena, string const &_name,
+                               string const &value) {
+  string name = _name.substr(strlen("cache:"));
+
+  if (name == "dir") {
+    struct stat st;
+    if (!value.empty() &&
+        (stat(value.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))) {
+      H_DEBUG << "Cache directory does not exist: " << value << "\n";
+      return false;
+    }
+    athena->cacheDir = value;
+    athena->resetEngines();
+    return true;
+  }
+
+  size_t budget;
+  if (!parseByteSize(value, budget))
+    return false;
+
+  if (name == "modules") {
+    athena->moduleCacheBudget = budget;
+    athena->resetEngines();
+    return true;
+  }
+
+  if (name == "compiled") {
+    athena->compiledCode.setBudget(budget);
+    return true;
+  }
+
+  if (name == "evm2wasm") {
+    lock_guard<mutex> lock(athena->cacheLock);
+    athena->evm2wasmCache.setBudget(budget);
+    return true;
+  }
+
+  if (name == "sentinel") {
+    lock_guard<mutex> lock(athena->cacheLock);
+    athena->sentinelCache.setBudget(budget);
+    return true;
+  }
+
+  return false;
+}
+
+bool athena_parse_tier_option(athena_instance *athena, string const &_name,
+                              string const &value) {
+  string name = _name.substr(strlen("tier:"));
+
+  uint32_t count;
+  if (!parseCount(value, count))
+    return false;
+
+  if (name == "threshold") {
+    athena->tierThreshold = count;
+  } else if (name == "threads" && count > 0) {
+    athena->tierThreads = count;
+  } else {
+    return false;
+  }
+  athena->resetEngines();
+  return true;
+}
+
 evmc_set_option_result athena_set_option(evmc_vm *instance, char const *name,
                                          char const *value) noexcept {
   athena_instance *athena = static_cast<athena_instance *>(instance);
@@ -472,16 +988,39 @@ evmc_set_option_result athena_set_option(evmc_vm *instance, char const *name,
   }
 
   if (strcmp(name, "metering") == 0) {
-    if (strcmp(value, "true") == 0)
-      athena->metering = true;
-    else if (strcmp(value, "false") != 0)
+    const bool sentinel = strcmp(value, "true") == 0;
+    const bool native = strcmp(value, "native") == 0;
+    if (!sentinel && !native && strcmp(value, "false") != 0)
+      return EVMC_SET_OPTION_INVALID_VALUE;
+    if (native && !athena->wasmEngineCreateFn()->supportsNativeMetering())
       return EVMC_SET_OPTION_INVALID_VALUE;
+    athena->metering = sentinel;
+    athena->nativeMetering = native;
+    return EVMC_SET_OPTION_SUCCESS;
+  }
+
+  if (strcmp(name, "metering:costs") == 0) {
+    struct stat st;
+    InstructionCosts costs;
+    if (stat(value, &st) != 0 || !S_ISREG(st.st_mode)) {
+      H_DEBUG << "Cost table does not exist: " << value << "\n";
+      return EVMC_SET_OPTION_INVALID_VALUE;
+    }
+    bytes contents = loadFileContents(value);
+    if (!parseInstructionCosts(string{contents.begin(), contents.end()},
+                               costs)) {
+      H_DEBUG << "Invalid cost table: " << value << "\n";
+      return EVMC_SET_OPTION_INVALID_VALUE;
+    }
+    athena->instructionCosts = costs;
+    athena->resetEngines();
     return EVMC_SET_OPTION_SUCCESS;
   }
 
   if (strcmp(name, "benchmark") == 0) {
     if (strcmp(value, "true") == 0) {
-      WasmEngine::enableBenchmarking();
+      athena->benchmarking = true;
+      athena->resetEngines();
       return EVMC_SET_OPTION_SUCCESS;
     }
     return EVMC_SET_OPTION_INVALID_VALUE;
@@ -490,8 +1029,10 @@ evmc_set_option_result athena_set_option(evmc_vm *instance, char const *name,
   if (strcmp(name, "engine") == 0) {
     auto it = wasm_engine_map.find(value);
     if (it != wasm_engine_map.end()) {
-      wasmEngineCreateFn = it->second;
-      athena->engine = wasmEngineCreateFn();
+      if (athena->nativeMetering && !it->second()->supportsNativeMetering())
+        return EVMC_SET_OPTION_INVALID_VALUE;
+      athena->wasmEngineCreateFn = it->second;
+      athena->resetEngines();
       return EVMC_SET_OPTION_SUCCESS;
     }
     return EVMC_SET_OPTION_INVALID_VALUE;
@@ -503,11 +1044,53 @@ evmc_set_option_result athena_set_option(evmc_vm *instance, char const *name,
     return EVMC_SET_OPTION_INVALID_VALUE;
   }
 
+  if (strncmp(name, "cache:", 6) == 0) {
+    if (athena_parse_cache_option(athena, string(name), string(value)))
+      return EVMC_SET_OPTION_SUCCESS;
+    return EVMC_SET_OPTION_INVALID_VALUE;
+  }
+
+  if (strncmp(name, "tier:", 5) == 0) {
+    if (athena_parse_tier_option(athena, string(name), string(value)))
+      return EVMC_SET_OPTION_SUCCESS;
+    return EVMC_SET_OPTION_INVALID_VALUE;
+  }
+
+  if (strcmp(name, "timeout") == 0) {
+    uint32_t milliseconds;
+    if (!parseCount(value, milliseconds))
+      return EVMC_SET_OPTION_INVALID_VALUE;
+    athena->timeLimit = milliseconds;
+    athena->resetEngines();
+    return EVMC_SET_OPTION_SUCCESS;
+  }
+
+  if (strcmp(name, "static:serialize") == 0) {
+    if (strcmp(value, "true") == 0 || strcmp(value, "false") == 0) {
+      athena->serializeStaticHost = strcmp(value, "true") == 0;
+      return EVMC_SET_OPTION_SUCCESS;
+    }
+    return EVMC_SET_OPTION_INVALID_VALUE;
+  }
+
+  if (strcmp(name, "batch:threads") == 0) {
+    uint32_t count;
+    if (!parseCount(value, count))
+      return EVMC_SET_OPTION_INVALID_VALUE;
+    athena->setBatchThreads(count);
+    return EVMC_SET_OPTION_SUCCESS;
+  }
+
   return EVMC_SET_OPTION_INVALID_NAME;
 }
 
 void athena_destroy(evmc_vm *instance) noexcept {
   athena_instance *athena = static_cast<athena_instance *>(instance);
+#if H_DEBUGGING
+  auto const &stats = athena->sentinelCache.stats();
+  H_DEBUG << "Sentinel cache: " << stats.hits << " hits, " << stats.misses
+          << " misses, " << stats.evictions << " evictions\n";
+#endif
   delete athena;
 }
 
@@ -562,6 +1145,89 @@ EVMC_EXPORT evmc_vm *evmc_create_athena() noexcept {
   return instance;
 }
 
+EVMC_EXPORT size_t athena_execute_batch(
+    evmc_vm *instance, const evmc_host_interface *host_interface,
+    enum evmc_revision rev, const athena_batch_message *messages,
+    size_t count, evmc_result *results) noexcept {
+  athena_instance *athena = static_cast<athena_instance *>(instance);
+
+  // Value transfers are up to the client, so the batch ends before the first
+  // message that makes one.
+  size_t end = 0;
+  while (end < count && is_zero(evmc::uint256be{messages[end].msg->value}))
+    end++;
+
+  // The client charges the senders and pays the coinbase between messages,
+  // which no speculation sees, so a message reading them is left to it.
+  Accounts clientAccounts;
+  for (size_t i = 0; i < end; i++) {
+    const evmc_tx_context tx =
+        host_interface->get_tx_context(messages[i].context);
+    clientAccounts.insert(messages[i].msg->sender);
+    clientAccounts.insert(tx.tx_origin);
+    clientAccounts.insert(tx.block_coinbase);
+  }
+
+  vector<unique_ptr<Speculation>> speculations =
+      speculate(athena, *host_interface, rev, messages, end);
+
+  athena_thread_state &state = athena->threadState();
+  // Slots stored by the messages committed so far, which no speculation saw.
+  StorageKeys written;
+  for (size_t i = 0; i < end; i++) {
+    unique_ptr<Speculation> &speculation = speculations[i];
+    if (speculation->overlay.readAny(written)) {
+      // Execute it again on the state the messages before it left.
+      speculation =
+          make_unique<Speculation>(*host_interface, messages[i].context);
+      speculation->result =
+          execute(athena, state, speculation->overlay, rev, messages[i].msg,
+                  messages[i].code, messages[i].code_size);
+    }
+    if (speculation->overlay.escaped() ||
+        speculation->overlay.readAny(clientAccounts))
+      return i;
+    // A failed message leaves no changes behind.
+    if (speculation->result.status_code == EVMC_SUCCESS) {
+      evmc::HostContext host{*host_interface, messages[i].context};
+      speculation->overlay.commit(host, written);
+    }
+    results[i] = speculation->take();
+  }
+  return end;
+}
+
+EVMC_EXPORT evmc_result athena_execute_static(
+    evmc_vm *instance, const evmc_host_interface *host_interface,
+    evmc_host_context *context, enum evmc_revision rev,
+    const evmc_message *msg, const uint8_t *code, size_t code_size) noexcept {
+  athena_instance *athena = static_cast<athena_instance *>(instance);
+  evmc_message message = *msg;
+  message.flags |= EVMC_STATIC;
+  ReadOnlyHost host{*host_interface, context,
+                    athena->staticHostLock(context)};
+  return execute(athena, athena->threadState(), host, rev, &message, code,
+                 code_size);
+}
+
+EVMC_EXPORT bool athena_get_cache_stats(evmc_vm *instance, const char *cache,
+                                        athena_cache_stats *stats) noexcept {
+  athena_instance *athena = static_cast<athena_instance *>(instance);
+  auto copyStats = [&](auto const &codeCache) {
+    lock_guard<mutex> lock(athena->cacheLock);
+    auto const &counters = codeCache.stats();
+    stats->hits = counters.hits;
+    stats->misses = counters.misses;
+    stats->evictions = counters.evictions;
+    return true;
+  };
+  if (strcmp(cache, "evm2wasm") == 0)
+    return copyStats(athena->evm2wasmCache);
+  if (strcmp(cache, "sentinel") == 0)
+    return copyStats(athena->sentinelCache);
+  return false;
+}
+
 #if athena_EXPORTS
 // If compiled as shared library, also export this symbol.
 EVMC_EXPORT evmc_vm *evmc_create() noexcept { return evmc_create_athena(); }
@@ -0,0 +1,187 @@
+/*
+ * Copyright 2019-2020 Jesse Kuang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+#include "helpers.h"
+
+namespace athena {
+
+/// A bounded cache of values derived from contract code, such as compiled
+/// modules.
+///
+/// Entries are addressed by the digest of the code and a hit is confirmed
+/// against the full code, so digest collisions only cost a miss. Once the
+/// accounted size exceeds the budget the least recently used entries are
+/// evicted. A budget of zero disables the cache.
+template <typename Value> class CodeCache {
+public:
+  struct Item {
+    bytes code;
+    Value value;
+    size_t cost = 0;
+  };
+
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+  };
+
+  explicit CodeCache(size_t budget = 0) : m_budget(budget) {}
+
+  CodeCache(CodeCache const &) = delete;
+  CodeCache &operator=(CodeCache const &) = delete;
+
+  /// Moves the entry for @code out of the cache. The caller returns it with
+  /// put() once done with it, so a nested execution of the same code misses
+  /// instead of sharing the value.
+  std::optional<Item> take(bytes_view code) {
+    auto it = lookup(code);
+    if (it == m_entries.end())
+      return std::nullopt;
+    Item item = std::move(it->item);
+    m_used -= it->charge;
+    m_index.erase(it->digest);
+    m_entries.erase(it);
+    return item;
+  }
+
+  /// Returns a copy of the value cached for @code.
+  std::optional<Value> get(bytes_view code) {
+    auto it = lookup(code);
+    if (it == m_entries.end())
+      return std::nullopt;
+    m_entries.splice(m_entries.begin(), m_entries, it);
+    return it->item.value;
+  }
+
+  /// Inserts @item, replacing any entry with the same digest. The item is
+  /// dropped if it alone exceeds the budget. Its cost is accounted on top of
+  /// the size of the code kept for confirming hits.
+  void put(Item item) {
+    const size_t charge = item.cost + item.code.size();
+    if (charge > m_budget)
+      return;
+    const uint64_t digest = codeDigest(item.code);
+    auto found = m_index.find(digest);
+    if (found != m_index.end()) {
+      m_used -= found->second->charge;
+      m_entries.erase(found->second);
+      m_index.erase(found);
+    }
+    evict(m_budget - charge);
+    m_used += charge;
+    m_entries.push_front({digest, charge, std::move(item)});
+    m_index.emplace(digest, m_entries.begin());
+  }
+
+  void setBudget(size_t budget) {
+    m_budget = budget;
+    evict(m_budget);
+  }
+
+  void clear() {
+    m_index.clear();
+    m_entries.clear();
+    m_used = 0;
+  }
+
+  /// Returns whether @code has an entry, without counting a hit or miss.
+  bool contains(bytes_view code) const {
+    auto found = m_index.find(codeDigest(code));
+    return found != m_index.end() && found->second->item.code == code;
+  }
+
+  size_t budget() const noexcept { return m_budget; }
+  size_t used() const noexcept { return m_used; }
+  size_t count() const noexcept { return m_entries.size(); }
+  Stats const &stats() const noexcept { return m_stats; }
+
+private:
+  struct Entry {
+    uint64_t digest;
+    size_t charge;
+    Item item;
+  };
+  using List = std::list<Entry>;
+
+  typename List::iterator lookup(bytes_view code) {
+    if (m_budget == 0)
+      return m_entries.end();
+    auto found = m_index.find(codeDigest(code));
+    if (found == m_index.end() || found->second->item.code != code) {
+      ++m_stats.misses;
+      return m_entries.end();
+    }
+    ++m_stats.hits;
+    return found->second;
+  }
+
+  void evict(size_t target) {
+    while (m_used > target && !m_entries.empty()) {
+      Entry &victim = m_entries.back();
+      m_used -= victim.charge;
+      m_index.erase(victim.digest);
+      m_entries.pop_back();
+      ++m_stats.evictions;
+    }
+  }
+
+  size_t m_budget;
+  size_t m_used = 0;
+  Stats m_stats;
+  // Most recently used first.
+  List m_entries;
+  std::unordered_map<uint64_t, typename List::iterator> m_index;
+};
+
+/// A CodeCache the engines of all threads share. Values are copied out, so
+/// large ones should be held by a shared pointer.
+template <typename Value> class SharedCodeCache {
+public:
+  using Item = typename CodeCache<Value>::Item;
+
+  explicit SharedCodeCache(size_t budget = 0) : m_cache(budget) {}
+
+  std::optional<Value> get(bytes_view code) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_cache.get(code);
+  }
+
+  void put(Item item) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_cache.put(std::move(item));
+  }
+
+  void setBudget(size_t budget) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_cache.setBudget(budget);
+  }
+
+private:
+  std::mutex m_lock;
+  CodeCache<Value> m_cache;
+};
+
+} // namespace athena
@@ -20,7 +20,7 @@ namespace athena {
 
 #if H_DEBUGGING
 
-#define H_DEBUG cerr
+#define H_DEBUG std::cerr
 
 #else
 
@@ -18,16 +18,23 @@
 
 #include <chrono>
 #include <cstdint>
+#include <memory>
 #include <string>
+#include <unordered_map>
 
 #include <evmc/evmc.h>
 #include <evmc/evmc.hpp>
 
+#include "cache.h"
 #include "exceptions.h"
 #include "helpers.h"
 
 namespace athena {
 
+/// Compiled code the engines of all threads share, in a form of the engine's
+/// choosing.
+using CompiledCodeCache = SharedCodeCache<std::shared_ptr<bytes const>>;
+
 struct ExecutionResult {
   int64_t gasLeft = 0;
   bytes returnValue;
@@ -37,17 +44,51 @@ struct ExecutionResult {
 // There is a single engine instance in each VM instance and
 // likely execute() is called multiple times. As a result
 // an engine implementation cannot have instance variables with
-// side-effects.
+// side-effects, other than caches of what it derives from the code.
 class WasmEngine {
 public:
   virtual ~WasmEngine() noexcept = default;
 
-  virtual ExecutionResult execute(evmc::HostContext &context, bytes_view code,
-                                  bytes_view state_code,
+  /// Executes @code. With @meterInstructions the engine charges gas for the
+  /// instructions itself, which only engines that support native metering
+  /// do.
+  virtual ExecutionResult execute(evmc::HostInterface &context,
+                                  bytes_view code, bytes_view state_code,
                                   evmc_message const &msg,
-                                  bool meterInterfaceGas) = 0;
+                                  bool meterInterfaceGas,
+                                  bool meterInstructions) = 0;
+
+  /// Whether execute() can meter instructions, so code does not need to be
+  /// metered by the Sentinel contract.
+  virtual bool supportsNativeMetering() const noexcept { return false; }
+
+  /// Sets the gas execute() charges for each instruction when it meters
+  /// instructions.
+  virtual void setInstructionCosts(InstructionCosts const &) {}
+
+  /// Limits the memory the engine may spend on keeping instantiated modules
+  /// around between executions. Zero disables the cache.
+  virtual void setModuleCacheBudget(size_t) {}
+
+  /// Sets a cache the engine may share compiled code through with the
+  /// engines of other threads, so code is only compiled by one of them.
+  virtual void setCompiledCodeCache(CompiledCodeCache *) {}
+
+  /// Sets a directory the engine may persist compiled code in, so it
+  /// survives restarts. An empty path disables it.
+  virtual void setCacheDirectory(std::string const &) {}
 
-  static void enableBenchmarking() noexcept { benchmarkingEnabled = true; }
+  /// Makes the engine run new code on a cheap tier and compile it on
+  /// @threads background threads once it ran @threshold times. A threshold of
+  /// zero compiles all code before running it.
+  virtual void setTiering(uint32_t threshold, unsigned threads) {}
+
+  /// Makes execute() fail once the code of a call ran for @limit of wall-clock
+  /// time. Zero removes the limit.
+  virtual void setTimeLimit(std::chrono::milliseconds limit) {}
+
+  /// Logs the time spent on instantiating and executing each call.
+  void setBenchmarking(bool enabled) noexcept { benchmarkingEnabled = enabled; }
 
 protected:
   void instantiationStarted() noexcept {
@@ -69,14 +110,20 @@ private:
   void collectBenchmarkingData();
 
   using clock = std::chrono::high_resolution_clock;
-  static bool benchmarkingEnabled;
+  bool benchmarkingEnabled = false;
   clock::time_point instantiationStartTime;
   clock::time_point executionStartTime;
 };
 
-class EthereumInterface {
+/// The Ethereum Environment Interface, instantiated once per engine.
+///
+/// Memory is the engine's accessor of the linear memory of the running
+/// instance. It provides `size_t size() const` and `uint8_t *data() const`,
+/// which are inlined into every host function. The definitions live in
+/// eei_impl.h, which only the engines include.
+template <typename Memory> class EthereumInterface {
 public:
-  explicit EthereumInterface(evmc::HostContext &_context, bytes_view _code,
+  explicit EthereumInterface(evmc::HostInterface &_context, bytes_view _code,
                              evmc_message const &_msg, ExecutionResult &_result,
                              bool _meterGas)
       : m_host(_context), m_code{_code}, m_msg(_msg), m_result(_result),
@@ -95,10 +142,10 @@ public:
   // which requires public methods.
   // TODO: update upstream WAVM/WABT to have a context (user data) passed down.
   // protected:
-  virtual size_t memorySize() const = 0;
-  virtual void memorySet(size_t offset, uint8_t value) = 0;
-  virtual uint8_t memoryGet(size_t offset) = 0;
-  virtual uint8_t *memoryPointer(size_t offset, size_t length) = 0;
+  // The linear memory of the running instance. Every access is bounds
+  // checked against memorySize() before it touches memoryBase().
+  size_t memorySize() const { return m_memory.size(); }
+  uint8_t *memoryBase() const { return m_memory.data(); }
 
   enum class EEICallKind { Call, CallCode, CallDelegate, CallStatic };
 
@@ -140,6 +187,12 @@ public:
   void eeiGetTxOrigin(uint32_t resultOffset);
   void eeiStorageStore(uint32_t pathOffset, uint32_t valueOffset);
   void eeiStorageLoad(uint32_t pathOffset, uint32_t resultOffset);
+  // Batched variants, taking @count consecutive 32-byte paths and values.
+  // Each slot is charged like a single store or load.
+  void eeiStorageStoreMulti(uint32_t pathsOffset, uint32_t valuesOffset,
+                            uint32_t count);
+  void eeiStorageLoadMulti(uint32_t pathsOffset, uint32_t resultOffset,
+                           uint32_t count);
   void eeiFinish(uint32_t offset, uint32_t size) {
     eeiRevertOrFinish(false, offset, size);
   }
@@ -160,7 +213,14 @@ private:
 
   void takeGas(int64_t gas);
 
+  void storeSlot(evmc::bytes32 const &path, evmc::bytes32 const &value);
+  // Returns the cached value of storage slot @path of the executing account,
+  // loading it from the host on first access.
+  evmc::bytes32 &storageSlot(evmc::bytes32 const &path);
+
   void ensureSourceMemoryBounds(uint32_t offset, uint32_t length);
+  const uint8_t *sourceMemory(uint32_t offset, size_t length);
+  uint8_t *destinationMemory(uint32_t offset, size_t length);
   void loadMemoryReverse(uint32_t srcOffset, uint8_t *dst, size_t length);
   void loadMemory(uint32_t srcOffset, uint8_t *dst, size_t length);
   void loadMemory(uint32_t srcOffset, bytes &dst, size_t length);
@@ -194,12 +254,24 @@ protected:
   /* Checks for overflow and safely charges gas for variable length data copies
    */
   void safeChargeDataCopy(uint32_t length, unsigned baseCost);
-  evmc::HostContext &m_host;
+  evmc::HostInterface &m_host;
   bytes_view m_code;
   evmc_message const &m_msg;
   bytes m_lastReturnData;
   ExecutionResult &m_result;
   bool m_meterGas = true;
+  Memory m_memory;
+
+private:
+  struct SlotHash {
+    size_t operator()(evmc::bytes32 const &path) const noexcept {
+      return codeDigest({path.bytes, sizeof(path.bytes)});
+    }
+  };
+  // Storage of the executing account as seen by this frame, so repeated
+  // accesses to a slot stay out of the host. Cleared whenever a nested call
+  // could have changed it.
+  std::unordered_map<evmc::bytes32, evmc::bytes32, SlotHash> m_storage;
 };
 
 struct GasSchedule {
@@ -0,0 +1,1023 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "debugging.h"
+#include "eei.h"
+#include "exceptions.h"
+#include "helpers.h"
+
+#include <evmc/instructions.h>
+
+// Definitions of the EthereumInterface template, included by the engines
+// that instantiate it.
+
+namespace athena {
+
+/* Checks if host supplied 256 bit value exceeds UINT128_MAX */
+bool exceedsUint128(evmc_uint256be const &value) noexcept;
+// Copies @length bytes from @src to @dst in reverse order, converting between
+// the little-endian memory layout and big-endian EVMC values.
+void copyReversed(uint8_t *dst, const uint8_t *src, size_t length);
+
+// Copies between linear memory and host buffers. Zero-length copies may come
+// with pointers memcpy must not be given.
+inline void copyBytes(uint8_t *dst, const uint8_t *src, size_t length) {
+  if (length)
+    std::memcpy(dst, src, length);
+}
+
+#if H_DEBUGGING
+template <typename Memory>
+void EthereumInterface<Memory>::debugPrint32(uint32_t value) {
+  H_DEBUG << "DEBUG print32: " << value << " " << std::hex << "0x" << value
+          << std::dec << std::endl;
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::debugPrint64(uint64_t value) {
+  H_DEBUG << "DEBUG print64: " << value << " " << std::hex << "0x" << value
+          << std::dec << std::endl;
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::debugPrint(uint32_t offset, uint32_t length) {
+  athenaAssert((offset + length) > offset, "Overflow.");
+  athenaAssert(memorySize() >= (offset + length), "Out of memory bounds.");
+
+  H_DEBUG << depthToString() << " DEBUG print: ";
+  {
+    const uint8_t *memory = memoryBase();
+    std::cerr << std::hex;
+    for (uint32_t i = offset; i < (offset + length); i++) {
+      std::cerr << static_cast<char>(memory[i]);
+    }
+    std::cerr << std::dec;
+  }
+  H_DEBUG << std::endl;
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::debugPrintMem(bool useHex, uint32_t offset,
+                                              uint32_t length) {
+  athenaAssert((offset + length) > offset, "Overflow.");
+  athenaAssert(memorySize() >= (offset + length), "Out of memory bounds.");
+
+  std::cerr << depthToString() << " DEBUG printMem" << (useHex ? "Hex(" : "(")
+            << std::hex << "0x" << offset << ":0x" << length << "): "
+            << std::dec;
+  const uint8_t *memory = memoryBase();
+  if (useHex) {
+    std::cerr << std::hex;
+    for (uint32_t i = offset; i < (offset + length); i++) {
+      std::cerr << static_cast<int>(memory[i]) << " ";
+    }
+    std::cerr << std::dec;
+  } else {
+    for (uint32_t i = offset; i < (offset + length); i++) {
+      std::cerr << memory[i] << " ";
+    }
+  }
+  std::cerr << std::endl;
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::debugPrintStorage(bool useHex,
+                                                  uint32_t pathOffset) {
+  evmc_uint256be path = loadBytes32(pathOffset);
+
+  H_DEBUG << depthToString() << " DEBUG printStorage" << (useHex ? "Hex" : "")
+          << "(0x" << std::hex;
+
+  // Print out the path
+  for (uint8_t b : path.bytes)
+    std::cerr << static_cast<int>(b);
+
+  H_DEBUG << "): " << std::dec;
+
+  evmc_bytes32 result = m_host.get_storage(m_msg.destination, path);
+
+  if (useHex) {
+    std::cerr << std::hex;
+    for (uint8_t b : result.bytes)
+      std::cerr << static_cast<int>(b) << " ";
+    std::cerr << std::dec;
+  } else {
+    for (uint8_t b : result.bytes)
+      std::cerr << b << " ";
+  }
+  std::cerr << std::endl;
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::debugEvmTrace(uint32_t pc, int32_t opcode,
+                                              uint32_t cost, int32_t sp) {
+  H_DEBUG << depthToString() << " evmTrace\n";
+
+  static constexpr int stackItemSize = sizeof(evmc_uint256be);
+  athenaAssert(sp <= (1024 * stackItemSize),
+               "EVM stack pointer out of bounds.");
+  athenaAssert(opcode >= 0x00 && opcode <= 0xff, "Invalid EVM instruction.");
+
+  const char *const *const opNamesTable =
+      evmc_get_instruction_names_table(EVMC_BYZANTIUM);
+  const char *opName = opNamesTable[static_cast<uint8_t>(opcode)];
+  if (opName == nullptr)
+    opName = "UNDEFINED";
+
+  std::cout << "{\"depth\":" << std::dec << m_msg.depth << ",\"gas\":"
+            << m_result.gasLeft << ",\"gasCost\":" << cost << ",\"op\":"
+            << opName << ",\"pc\":" << pc << ",\"stack\":[";
+
+  for (int32_t i = 0; i <= sp; i += stackItemSize) {
+    evmc_uint256be x = loadUint256(static_cast<uint32_t>(i));
+    std::cout << '"' << toHex(x) << '"';
+    if (i != sp)
+      std::cout << ',';
+  }
+  std::cout << "]}" << std::endl;
+}
+#endif
+
+template <typename Memory>
+void EthereumInterface<Memory>::eeiUseGas(int64_t gas) {
+#if H_DEBUGGING
+  H_DEBUG << depthToString() << " useGas " << gas << "\n";
+#endif
+
+  ensureCondition(gas >= 0, ArgumentOutOfRange, "Negative gas supplied.");
+
+  takeGas(gas);
+}
+
+template <typename Memory>
+int64_t EthereumInterface<Memory>::eeiGetGasLeft() {
+  H_DEBUG << depthToString() << " getGasLeft\n";
+
+  static_assert(std::is_same<decltype(m_result.gasLeft), int64_t>::value,
+                "int64_t type expected");
+
+  takeInterfaceGas(GasSchedule::base);
+
+  return m_result.gasLeft;
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::eeiGetAddress(uint32_t resultOffset) {
+  H_DEBUG << depthToString() << " getAddress " << std::hex << resultOffset
+          << std::dec << "\n";
+
+  takeInterfaceGas(GasSchedule::base);
+
+  storeAddress(m_msg.destination, resultOffset);
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::eeiGetExternalBalance(uint32_t addressOffset,
+                                                      uint32_t resultOffset) {
+  H_DEBUG << depthToString() << " getExternalBalance " << std::hex
+          << addressOffset << " " << resultOffset << std::dec << "\n";
+
+  takeInterfaceGas(GasSchedule::balance);
+
+  evmc_address address = loadAddress(addressOffset);
+  evmc_uint256be balance = m_host.get_balance(address);
+  storeUint128(balance, resultOffset);
+}
+
+template <typename Memory>
+uint32_t EthereumInterface<Memory>::eeiGetBlockHash(uint64_t number,
+                                                    uint32_t resultOffset) {
+  H_DEBUG << depthToString() << " getBlockHash " << std::hex << number << " "
+          << resultOffset << std::dec << "\n";
+
+  takeInterfaceGas(GasSchedule::blockhash);
+
+  const auto blockhash = m_host.get_block_hash(static_cast<int64_t>(number));
+
+  if (is_zero(blockhash))
+    return 1;
+
+  storeBytes32(blockhash, resultOffset);
+
+  return 0;
+}
+
+template <typename Memory>
+uint32_t EthereumInterface<Memory>::eeiGetCallDataSize() {
+#if H_DEBUGGING
+  H_DEBUG << depthToString() << " getCallDataSize\n";
+#endif
+
+  takeInterfaceGas(GasSchedule::base);
+
+  return static_cast<uint32_t>(m_msg.input_size);
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::eeiCallDataCopy(uint32_t resultOffset,
+                                                uint32_t dataOffset,
+                                                uint32_t length) {
+#if H_DEBUGGING
+  H_DEBUG << depthToString() << " callDataCopy " << std::hex << resultOffset
+          << " " << dataOffset << " " << length << std::dec << "\n";
+#endif
+
+  safeChargeDataCopy(length, GasSchedule::verylow);
+
+  storeMemory({m_msg.input_data, m_msg.input_size}, dataOffset, resultOffset,
+              length);
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::eeiGetCaller(uint32_t resultOffset) {
+  H_DEBUG << depthToString() << " getCaller " << std::hex << resultOffset
+          << std::dec << "\n";
+
+  takeInterfaceGas(GasSchedule::base);
+
+  storeAddress(m_msg.sender, resultOffset);
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::eeiGetCallValue(uint32_t resultOffset) {
+  H_DEBUG << depthToString() << " getCallValue " << std::hex << resultOffset
+          << std::dec << "\n";
+
+  takeInterfaceGas(GasSchedule::base);
+
+  storeUint128(m_msg.value, resultOffset);
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::eeiCodeCopy(uint32_t resultOffset,
+                                            uint32_t codeOffset,
+                                            uint32_t length) {
+  H_DEBUG << depthToString() << " codeCopy " << std::hex << resultOffset << " "
+          << codeOffset << " " << length << std::dec << "\n";
+
+  safeChargeDataCopy(length, GasSchedule::verylow);
+
+  storeMemory(m_code, codeOffset, resultOffset, length);
+}
+
+template <typename Memory>
+uint32_t EthereumInterface<Memory>::eeiGetCodeSize() {
+  H_DEBUG << depthToString() << " getCodeSize\n";
+
+  takeInterfaceGas(GasSchedule::base);
+
+  return static_cast<uint32_t>(m_code.size());
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::eeiExternalCodeCopy(uint32_t addressOffset,
+                                                    uint32_t resultOffset,
+                                                    uint32_t codeOffset,
+                                                    uint32_t length) {
+  H_DEBUG << depthToString() << " externalCodeCopy " << std::hex
+          << addressOffset << " " << resultOffset << " " << codeOffset << " "
+          << length << std::dec << "\n";
+
+  safeChargeDataCopy(length, GasSchedule::extcode);
+
+  evmc_address address = loadAddress(addressOffset);
+  // TODO: optimise this so no copy needs to be created
+  bytes codeBuffer(length, '\0');
+  size_t numCopied = m_host.copy_code(address, codeOffset, codeBuffer.data(),
+                                      codeBuffer.size());
+  ensureCondition(numCopied == length, InvalidMemoryAccess,
+                  "Out of bounds (source) memory copy");
+
+  storeMemory(codeBuffer, 0, resultOffset, length);
+}
+
+template <typename Memory>
+uint32_t EthereumInterface<Memory>::eeiGetExternalCodeSize(
+    uint32_t addressOffset) {
+  H_DEBUG << depthToString() << " getExternalCodeSize " << std::hex
+          << addressOffset << std::dec << "\n";
+
+  takeInterfaceGas(GasSchedule::extcode);
+
+  evmc_address address = loadAddress(addressOffset);
+  size_t code_size = m_host.get_code_size(address);
+
+  return static_cast<uint32_t>(code_size);
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::eeiGetBlockCoinbase(uint32_t resultOffset) {
+  H_DEBUG << depthToString() << " getBlockCoinbase " << std::hex << resultOffset
+          << std::dec << "\n";
+
+  takeInterfaceGas(GasSchedule::base);
+
+  storeAddress(m_host.get_tx_context().block_coinbase, resultOffset);
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::eeiGetBlockDifficulty(uint32_t offset) {
+  H_DEBUG << depthToString() << " getBlockDifficulty " << std::hex << offset
+          << std::dec << "\n";
+
+  takeInterfaceGas(GasSchedule::base);
+
+  storeUint256(m_host.get_tx_context().block_difficulty, offset);
+}
+
+template <typename Memory>
+int64_t EthereumInterface<Memory>::eeiGetBlockGasLimit() {
+  H_DEBUG << depthToString() << " getBlockGasLimit\n";
+
+  takeInterfaceGas(GasSchedule::base);
+
+  static_assert(std::is_same<decltype(m_host.get_tx_context().block_gas_limit),
+                             int64_t>::value,
+                "int64_t type expected");
+
+  return m_host.get_tx_context().block_gas_limit;
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::eeiGetTxGasPrice(uint32_t valueOffset) {
+  H_DEBUG << depthToString() << " getTxGasPrice " << std::hex << valueOffset
+          << std::dec << "\n";
+
+  takeInterfaceGas(GasSchedule::base);
+
+  storeUint128(m_host.get_tx_context().tx_gas_price, valueOffset);
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::eeiLog(uint32_t dataOffset, uint32_t length,
+                                       uint32_t numberOfTopics, uint32_t topic1,
+                                       uint32_t topic2, uint32_t topic3,
+                                       uint32_t topic4) {
+  H_DEBUG << depthToString() << " log " << std::hex << dataOffset << " "
+          << length << " " << numberOfTopics << std::dec << "\n";
+
+  static_assert(GasSchedule::log <= 65536,
+                "Gas cost of log could lead to overflow");
+  static_assert(GasSchedule::logTopic <= 65536,
+                "Gas cost of logTopic could lead to overflow");
+  static_assert(GasSchedule::logData <= 65536,
+                "Gas cost of logData could lead to overflow");
+  // Using uint64_t to force a type issue if the underlying API changes.
+  takeInterfaceGas(GasSchedule::log + (GasSchedule::logTopic * numberOfTopics) +
+                   (GasSchedule::logData * int64_t(length)));
+
+  ensureCondition(!(m_msg.flags & EVMC_STATIC), StaticModeViolation, "log");
+
+  ensureCondition(numberOfTopics <= 4, ContractValidationFailure,
+                  "Too many topics specified");
+
+  // TODO: should this assert that unused topic offsets must be 0?
+  std::array<evmc::uint256be, 4> topics;
+  topics[0] = (numberOfTopics >= 1) ? loadBytes32(topic1) : evmc::uint256be{};
+  topics[1] = (numberOfTopics >= 2) ? loadBytes32(topic2) : evmc::uint256be{};
+  topics[2] = (numberOfTopics >= 3) ? loadBytes32(topic3) : evmc::uint256be{};
+  topics[3] = (numberOfTopics == 4) ? loadBytes32(topic4) : evmc::uint256be{};
+
+  ensureSourceMemoryBounds(dataOffset, length);
+  bytes data(length, '\0');
+  loadMemory(dataOffset, data, length);
+
+  m_host.emit_log(m_msg.destination, data.data(), length, topics.data(),
+                  numberOfTopics);
+}
+
+template <typename Memory>
+int64_t EthereumInterface<Memory>::eeiGetBlockNumber() {
+  H_DEBUG << depthToString() << " getBlockNumber\n";
+
+  takeInterfaceGas(GasSchedule::base);
+
+  static_assert(std::is_same<decltype(m_host.get_tx_context().block_number),
+                             int64_t>::value,
+                "int64_t type expected");
+
+  return m_host.get_tx_context().block_number;
+}
+
+template <typename Memory>
+int64_t EthereumInterface<Memory>::eeiGetBlockTimestamp() {
+  H_DEBUG << depthToString() << " getBlockTimestamp\n";
+
+  takeInterfaceGas(GasSchedule::base);
+
+  static_assert(std::is_same<decltype(m_host.get_tx_context().block_timestamp),
+                             int64_t>::value,
+                "int64_t type expected");
+
+  return m_host.get_tx_context().block_timestamp;
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::eeiGetTxOrigin(uint32_t resultOffset) {
+  H_DEBUG << depthToString() << " getTxOrigin " << std::hex << resultOffset
+          << std::dec << "\n";
+
+  takeInterfaceGas(GasSchedule::base);
+
+  storeAddress(m_host.get_tx_context().tx_origin, resultOffset);
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::eeiStorageStore(uint32_t pathOffset,
+                                                uint32_t valueOffset) {
+  H_DEBUG << depthToString() << " storageStore " << std::hex << pathOffset
+          << " " << valueOffset << std::dec << "\n";
+
+  storeSlot(loadBytes32(pathOffset), loadBytes32(valueOffset));
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::eeiStorageLoad(uint32_t pathOffset,
+                                               uint32_t resultOffset) {
+  H_DEBUG << depthToString() << " storageLoad " << std::hex << pathOffset << " "
+          << resultOffset << std::dec << "\n";
+
+  takeInterfaceGas(GasSchedule::storageLoad);
+
+  evmc_bytes32 path = loadBytes32(pathOffset);
+
+  storeBytes32(storageSlot(path), resultOffset);
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::eeiStorageStoreMulti(uint32_t pathsOffset,
+                                                     uint32_t valuesOffset,
+                                                     uint32_t count) {
+  H_DEBUG << depthToString() << " storageStoreMulti " << std::hex
+          << pathsOffset << " " << valuesOffset << " " << count << std::dec
+          << "\n";
+
+  const size_t length = size_t(count) * sizeof(evmc::bytes32);
+  ensureCondition(length <= std::numeric_limits<uint32_t>::max(),
+                  InvalidMemoryAccess, "Out of bounds (source) memory copy.");
+  ensureSourceMemoryBounds(pathsOffset, length);
+  ensureSourceMemoryBounds(valuesOffset, length);
+
+  for (uint32_t i = 0; i < count; i++) {
+    const uint32_t offset = i * sizeof(evmc::bytes32);
+    storeSlot(loadBytes32(pathsOffset + offset),
+              loadBytes32(valuesOffset + offset));
+  }
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::eeiStorageLoadMulti(uint32_t pathsOffset,
+                                                    uint32_t resultOffset,
+                                                    uint32_t count) {
+  H_DEBUG << depthToString() << " storageLoadMulti " << std::hex
+          << pathsOffset << " " << resultOffset << " " << count << std::dec
+          << "\n";
+
+  const size_t length = size_t(count) * sizeof(evmc::bytes32);
+  ensureCondition(length <= std::numeric_limits<uint32_t>::max(),
+                  InvalidMemoryAccess, "Out of bounds memory copy.");
+  ensureSourceMemoryBounds(pathsOffset, length);
+  destinationMemory(resultOffset, length);
+
+  // Load all paths first, the results may overwrite any of them.
+  std::vector<evmc::bytes32> paths(count);
+  loadMemory(pathsOffset, reinterpret_cast<uint8_t *>(paths.data()), length);
+  for (uint32_t i = 0; i < count; i++) {
+    takeInterfaceGas(GasSchedule::storageLoad);
+    storeBytes32(storageSlot(paths[i]),
+                 resultOffset + i * sizeof(evmc::bytes32));
+  }
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::storeSlot(evmc::bytes32 const &path,
+                                          evmc::bytes32 const &value) {
+  static_assert(GasSchedule::storageStoreCreate >=
+                    GasSchedule::storageStoreChange,
+                "storageStoreChange costs more than storageStoreCreate");
+
+  // Charge this here as it is the minimum cost.
+  takeInterfaceGas(GasSchedule::storageStoreChange);
+
+  ensureCondition(!(m_msg.flags & EVMC_STATIC), StaticModeViolation,
+                  "storageStore");
+
+  evmc::bytes32 &current = storageSlot(path);
+
+  // Charge the right amount in case of the create case.
+  if (is_zero(current) && !is_zero(value))
+    takeInterfaceGas(GasSchedule::storageStoreCreate -
+                     GasSchedule::storageStoreChange);
+
+  // We do not need to take care about the delete case (gas refund), the client
+  // does it.
+
+  // Written through, so the host sees every store in order.
+  m_host.set_storage(m_msg.destination, path, value);
+  current = value;
+}
+
+template <typename Memory>
+evmc::bytes32 &
+EthereumInterface<Memory>::storageSlot(evmc::bytes32 const &path) {
+  auto found = m_storage.find(path);
+  if (found != m_storage.end())
+    return found->second;
+  return m_storage
+      .emplace(path, m_host.get_storage(m_msg.destination, path))
+      .first->second;
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::eeiRevertOrFinish(bool revert, uint32_t offset,
+                                                  uint32_t size) {
+#if H_DEBUGGING
+  H_DEBUG << depthToString() << " " << (revert ? "revert " : "finish ")
+          << std::hex << offset << " " << size << std::dec << "\n";
+#endif
+
+  ensureSourceMemoryBounds(offset, size);
+  m_result.returnValue = bytes(size, '\0');
+  loadMemory(offset, m_result.returnValue, size);
+
+  m_result.isRevert = revert;
+
+  throw EndExecution{};
+}
+
+template <typename Memory>
+uint32_t EthereumInterface<Memory>::eeiGetReturnDataSize() {
+  H_DEBUG << depthToString() << " getReturnDataSize\n";
+
+  takeInterfaceGas(GasSchedule::base);
+
+  return static_cast<uint32_t>(m_lastReturnData.size());
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::eeiReturnDataCopy(uint32_t dataOffset,
+                                                  uint32_t offset,
+                                                  uint32_t size) {
+  H_DEBUG << depthToString() << " returnDataCopy " << std::hex << dataOffset
+          << " " << offset << " " << size << std::dec << "\n";
+
+  safeChargeDataCopy(size, GasSchedule::verylow);
+
+  storeMemory(m_lastReturnData, offset, dataOffset, size);
+}
+
+template <typename Memory>
+uint32_t EthereumInterface<Memory>::eeiCall(EEICallKind kind, int64_t gas,
+                                            uint32_t addressOffset,
+                                            uint32_t valueOffset,
+                                            uint32_t dataOffset,
+                                            uint32_t dataLength) {
+  ensureCondition(gas >= 0, ArgumentOutOfRange, "Negative gas supplied.");
+
+  evmc_message call_message;
+  call_message.destination = loadAddress(addressOffset);
+  call_message.flags = m_msg.flags & EVMC_STATIC;
+  call_message.depth = m_msg.depth + 1;
+
+  switch (kind) {
+  case EEICallKind::Call:
+  case EEICallKind::CallCode:
+    call_message.kind =
+        (kind == EEICallKind::CallCode) ? EVMC_CALLCODE : EVMC_CALL;
+    call_message.sender = m_msg.destination;
+    call_message.value = loadUint128(valueOffset);
+
+    if ((kind == EEICallKind::Call) && !evmc::is_zero(call_message.value)) {
+      ensureCondition(!(m_msg.flags & EVMC_STATIC), StaticModeViolation,
+                      "call");
+    }
+    break;
+  case EEICallKind::CallDelegate:
+    call_message.kind = EVMC_DELEGATECALL;
+    call_message.sender = m_msg.sender;
+    call_message.value = m_msg.value;
+    break;
+  case EEICallKind::CallStatic:
+    call_message.kind = EVMC_CALL;
+    call_message.flags |= EVMC_STATIC;
+    call_message.sender = m_msg.destination;
+    call_message.value = {};
+    break;
+  }
+
+#if H_DEBUGGING
+  std::string methodName;
+  switch (kind) {
+  case EEICallKind::Call:
+    methodName = "call";
+    break;
+  case EEICallKind::CallCode:
+    methodName = "callCode";
+    break;
+  case EEICallKind::CallDelegate:
+    methodName = "callDelegate";
+    break;
+  case EEICallKind::CallStatic:
+    methodName = "callStatic";
+    break;
+  }
+
+  H_DEBUG << depthToString() << " " << methodName << " " << std::hex << gas
+          << " " << addressOffset << " " << valueOffset << " " << dataOffset
+          << " " << dataLength << std::dec << "\n";
+#endif
+
+  // NOTE: this must be declared outside the condition to ensure the memory
+  // doesn't go out of scope
+  bytes input_data;
+  if (dataLength) {
+    ensureSourceMemoryBounds(dataOffset, dataLength);
+    input_data.resize(dataLength);
+    loadMemory(dataOffset, input_data, dataLength);
+    call_message.input_data = input_data.data();
+    call_message.input_size = dataLength;
+  } else {
+    call_message.input_data = nullptr;
+    call_message.input_size = 0;
+  }
+
+  // Start with base call gas
+  takeInterfaceGas(GasSchedule::call);
+
+  if (m_msg.depth >= 1024)
+    return 1;
+
+  // These checks are in EIP150 but not in the YellowPaper
+  // Charge valuetransfer gas if value is being transferred.
+  if ((kind == EEICallKind::Call || kind == EEICallKind::CallCode) &&
+      !evmc::is_zero(call_message.value)) {
+    takeInterfaceGas(GasSchedule::valuetransfer);
+
+    if (!enoughSenderBalanceFor(call_message.value))
+      return 1;
+
+    // Only charge callNewAccount gas if the account is new and non-zero value
+    // is being transferred per EIP161.
+    if ((kind == EEICallKind::Call) &&
+        !m_host.account_exists(call_message.destination))
+      takeInterfaceGas(GasSchedule::callNewAccount);
+  }
+
+  // This is the gas we are forwarding to the callee.
+  // Retain one 64th of it as per EIP150
+  gas = std::min(gas, maxCallGas(m_result.gasLeft));
+
+  takeInterfaceGas(gas);
+
+  // Add gas stipend for value transfers
+  if (!evmc::is_zero(call_message.value))
+    gas += GasSchedule::valueStipend;
+
+  call_message.gas = gas;
+
+  auto call_result = m_host.call(call_message);
+  // The callee may have reentered this account and changed its storage.
+  m_storage.clear();
+
+  if (call_result.output_data) {
+    m_lastReturnData.assign(call_result.output_data,
+                            call_result.output_data + call_result.output_size);
+  } else {
+    m_lastReturnData.clear();
+  }
+
+  /* Return unspent gas */
+  athenaAssert(call_result.gas_left >= 0, "EVMC returned negative gas left");
+  m_result.gasLeft += call_result.gas_left;
+
+  switch (call_result.status_code) {
+  case EVMC_SUCCESS:
+    return 0;
+  case EVMC_REVERT:
+    return 2;
+  default:
+    return 1;
+  }
+}
+
+template <typename Memory>
+uint32_t EthereumInterface<Memory>::eeiCreate(uint32_t valueOffset,
+                                              uint32_t dataOffset,
+                                              uint32_t length,
+                                              uint32_t resultOffset) {
+  H_DEBUG << depthToString() << " create " << std::hex << valueOffset << " "
+          << dataOffset << " " << length << std::dec << " " << resultOffset
+          << std::dec << "\n";
+
+  takeInterfaceGas(GasSchedule::create);
+
+  ensureCondition(!(m_msg.flags & EVMC_STATIC), StaticModeViolation, "create");
+
+  evmc_message create_message;
+
+  create_message.destination = {};
+  create_message.sender = m_msg.destination;
+  create_message.value = loadUint128(valueOffset);
+
+  if (m_msg.depth >= 1024)
+    return 1;
+  if (!enoughSenderBalanceFor(create_message.value))
+    return 1;
+
+  // NOTE: this must be declared outside the condition to ensure the memory
+  // doesn't go out of scope
+  bytes contract_code;
+  if (length) {
+    ensureSourceMemoryBounds(dataOffset, length);
+    contract_code.resize(length);
+    loadMemory(dataOffset, contract_code, length);
+    create_message.input_data = contract_code.data();
+    create_message.input_size = length;
+  } else {
+    create_message.input_data = nullptr;
+    create_message.input_size = 0;
+  }
+
+  create_message.depth = m_msg.depth + 1;
+  create_message.kind = EVMC_CREATE;
+  create_message.flags = 0;
+
+  int64_t gas = maxCallGas(m_result.gasLeft);
+  create_message.gas = gas;
+  takeInterfaceGas(gas);
+
+  auto create_result = m_host.call(create_message);
+  // The init code may have called back into this account.
+  m_storage.clear();
+
+  /* Return unspent gas */
+  athenaAssert(create_result.gas_left >= 0, "EVMC returned negative gas left");
+  m_result.gasLeft += create_result.gas_left;
+
+  if (create_result.status_code == EVMC_SUCCESS) {
+    storeAddress(create_result.create_address, resultOffset);
+    m_lastReturnData.clear();
+  } else if (create_result.output_data) {
+    m_lastReturnData.assign(create_result.output_data,
+                            create_result.output_data +
+                                create_result.output_size);
+  } else {
+    m_lastReturnData.clear();
+  }
+
+  switch (create_result.status_code) {
+  case EVMC_SUCCESS:
+    return 0;
+  case EVMC_REVERT:
+    return 2;
+  default:
+    return 1;
+  }
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::eeiSelfDestruct(uint32_t addressOffset) {
+  H_DEBUG << depthToString() << " selfDestruct " << std::hex << addressOffset
+          << std::dec << "\n";
+
+  takeInterfaceGas(GasSchedule::selfdestruct);
+
+  ensureCondition(!(m_msg.flags & EVMC_STATIC), StaticModeViolation,
+                  "selfDestruct");
+
+  evmc_address address = loadAddress(addressOffset);
+
+  if (!m_host.account_exists(address))
+    takeInterfaceGas(GasSchedule::callNewAccount);
+
+  m_host.selfdestruct(m_msg.destination, address);
+
+  throw EndExecution{};
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::takeGas(int64_t gas) {
+  // NOTE: gas >= 0 is validated by the callers of this method
+  ensureCondition(gas <= m_result.gasLeft, OutOfGas, "Out of gas.");
+  m_result.gasLeft -= gas;
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::takeInterfaceGas(int64_t gas) {
+  if (!m_meterGas)
+    return;
+  athenaAssert(gas >= 0, "Trying to take negative gas.");
+  takeGas(gas);
+}
+
+/*
+ * Memory Operations
+ */
+
+template <typename Memory>
+void EthereumInterface<Memory>::ensureSourceMemoryBounds(uint32_t offset,
+                                                         uint32_t length) {
+  ensureCondition((offset + length) >= offset, InvalidMemoryAccess,
+                  "Out of bounds (source) memory copy.");
+  ensureCondition(memorySize() >= (offset + length), InvalidMemoryAccess,
+                  "Out of bounds (source) memory copy.");
+}
+
+template <typename Memory>
+const uint8_t *EthereumInterface<Memory>::sourceMemory(uint32_t offset,
+                                                       size_t length) {
+  ensureCondition((offset + length) >= offset, InvalidMemoryAccess,
+                  "Out of bounds (source) memory copy.");
+  ensureCondition(memorySize() >= (offset + length), InvalidMemoryAccess,
+                  "Out of bounds (source) memory copy.");
+
+  if (!length)
+    H_DEBUG << "Zero-length memory load from offset 0x" << std::hex << offset
+            << std::dec << "\n";
+
+  return memoryBase() + offset;
+}
+
+template <typename Memory>
+uint8_t *EthereumInterface<Memory>::destinationMemory(uint32_t offset,
+                                                      size_t length) {
+  ensureCondition((offset + length) >= offset, InvalidMemoryAccess,
+                  "Out of bounds (destination) memory copy.");
+  ensureCondition(memorySize() >= (offset + length), InvalidMemoryAccess,
+                  "Out of bounds (destination) memory copy.");
+
+  if (!length)
+    H_DEBUG << "Zero-length memory store to offset 0x" << std::hex << offset
+            << std::dec << "\n";
+
+  return memoryBase() + offset;
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::loadMemoryReverse(uint32_t srcOffset,
+                                                  uint8_t *dst, size_t length) {
+  copyReversed(dst, sourceMemory(srcOffset, length), length);
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::loadMemory(uint32_t srcOffset, uint8_t *dst,
+                                           size_t length) {
+  copyBytes(dst, sourceMemory(srcOffset, length), length);
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::loadMemory(uint32_t srcOffset, bytes &dst,
+                                           size_t length) {
+  ensureCondition(dst.size() >= length, InvalidMemoryAccess,
+                  "Out of bounds (destination) memory copy.");
+  copyBytes(dst.data(), sourceMemory(srcOffset, length), length);
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::storeMemoryReverse(const uint8_t *src,
+                                                   uint32_t dstOffset,
+                                                   uint32_t length) {
+  copyReversed(destinationMemory(dstOffset, length), src, length);
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::storeMemory(const uint8_t *src,
+                                            uint32_t dstOffset,
+                                            uint32_t length) {
+  copyBytes(destinationMemory(dstOffset, length), src, length);
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::storeMemory(bytes_view src, uint32_t srcOffset,
+                                            uint32_t dstOffset,
+                                            uint32_t length) {
+  ensureCondition((srcOffset + length) >= srcOffset, InvalidMemoryAccess,
+                  "Out of bounds (source) memory copy.");
+  ensureCondition(src.size() >= (srcOffset + length), InvalidMemoryAccess,
+                  "Out of bounds (source) memory copy.");
+  copyBytes(destinationMemory(dstOffset, length), src.data() + srcOffset,
+            length);
+}
+
+/*
+ * Memory Op Wrapper Functions
+ */
+
+template <typename Memory>
+evmc::bytes32 EthereumInterface<Memory>::loadBytes32(uint32_t srcOffset) {
+  evmc::bytes32 dst;
+  loadMemory(srcOffset, dst.bytes, 32);
+  return dst;
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::storeBytes32(evmc::uint256be const &src,
+                                             uint32_t dstOffset) {
+  storeMemory(src.bytes, dstOffset, 32);
+}
+
+template <typename Memory>
+evmc::uint256be EthereumInterface<Memory>::loadUint256(uint32_t srcOffset) {
+  evmc::uint256be dst;
+  loadMemoryReverse(srcOffset, dst.bytes, 32);
+  return dst;
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::storeUint256(evmc::uint256be const &src,
+                                             uint32_t dstOffset) {
+  storeMemoryReverse(src.bytes, dstOffset, 32);
+}
+
+template <typename Memory>
+evmc::address EthereumInterface<Memory>::loadAddress(uint32_t srcOffset) {
+  evmc::address dst;
+  loadMemory(srcOffset, dst.bytes, 20);
+  return dst;
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::storeAddress(evmc::address const &src,
+                                             uint32_t dstOffset) {
+  storeMemory(src.bytes, dstOffset, 20);
+}
+
+template <typename Memory>
+evmc::uint256be EthereumInterface<Memory>::loadUint128(uint32_t srcOffset) {
+  evmc::uint256be dst;
+  loadMemoryReverse(srcOffset, dst.bytes + 16, 16);
+  return dst;
+}
+
+template <typename Memory>
+void EthereumInterface<Memory>::storeUint128(evmc::uint256be const &src,
+                                             uint32_t dstOffset) {
+  ensureCondition(!exceedsUint128(src), ArgumentOutOfRange,
+                  "Account balance (or transaction value) exceeds 128 bits.");
+  storeMemoryReverse(src.bytes + 16, dstOffset, 16);
+}
+
+/*
+ * Utilities
+ */
+template <typename Memory>
+void EthereumInterface<Memory>::safeChargeDataCopy(uint32_t length,
+                                                   unsigned baseCost) {
+  takeInterfaceGas(baseCost);
+
+  // Since length here is 32 bits divided by 32 (aka shifted right by 5 bits),
+  // we can assume the upper bound for values is 27 bits.
+  //
+  // Since `gas` is 63 bits wide, that means we have an extra 36 bits of
+  // headroom.
+  //
+  // Allow 16 bits here.
+  static_assert(GasSchedule::copy <= 65536,
+                "Gas cost of copy could lead to overflow");
+  // Using uint64_t to force a type issue if the underlying API changes.
+  takeInterfaceGas(GasSchedule::copy * ((int64_t(length) + 31) / 32));
+}
+
+template <typename Memory>
+bool EthereumInterface<Memory>::enoughSenderBalanceFor(
+    evmc_uint256be const &value) {
+  evmc_uint256be balance = m_host.get_balance(m_msg.destination);
+  return safeLoadUint128(balance) >= safeLoadUint128(value);
+}
+
+template <typename Memory>
+unsigned __int128 EthereumInterface<Memory>::safeLoadUint128(
+    evmc_uint256be const &value) {
+  ensureCondition(!exceedsUint128(value), ArgumentOutOfRange,
+                  "Account balance (or transaction value) exceeds 128 bits.");
+  unsigned __int128 ret = 0;
+  for (unsigned i = 16; i < 32; i++) {
+    ret <<= 8;
+    ret |= value.bytes[i];
+  }
+  return ret;
+}
+} // namespace athena
@@ -19,30 +19,33 @@
 #include <eosio/vm/host_function.hpp>
 #include <eosio/vm/watchdog.hpp>
 
+#include "cache.h"
 #include "debugging.h"
+#include "eei_impl.h"
 #include "eosvm.h"
+#include "worker_pool.h"
 
 #include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <athena/buildinfo.h>
 
 using namespace eosio;
 using namespace eosio::vm;
 //#pragma GCC diagnostic ignored "-Wunused-parameter"
 //#pragma GCC diagnostic ignored "-Wunused-variable"
 
-namespace eosio::vm {
-
-template <typename T> struct wasm_type_converter<T *> {
-  static T *from_wasm(void *val) { return (T *)val; }
-  static void *to_wasm(T *val) { return (void *)val; }
-};
-
-template <typename T> struct wasm_type_converter<T &> {
-  static T &from_wasm(T *val) { return *val; }
-  static T *to_wasm(T &val) { return std::addressof(val); }
-};
-} // namespace eosio::vm
-
 using namespace std;
 using namespace evmc;
 
@@ -50,273 +53,592 @@ namespace athena {
 
 const string ethMod = "ethereum";
 const string dbgMod = "debug";
+// Modules executing static calls bind the imports registered under this
+// variant of the ethereum module.
+const string staticVariant = ":static";
 
 class EOSvmEthereumInterface;
 using backend_t = eosio::vm::backend<EOSvmEthereumInterface, eosio::vm::jit>;
-// using backend_t = eosio::vm::backend<EOSvmEthereumInterface>;
+using interpreter_t =
+    eosio::vm::backend<EOSvmEthereumInterface, eosio::vm::interpreter>;
+using rhf_t = eosio::vm::registered_host_functions<EOSvmEthereumInterface>;
 
-class EOSvmEthereumInterface : public EthereumInterface {
+// Linear memory of the instance being executed.
+struct EOSvmMemory {
+  wasm_allocator *alloc = nullptr;
+
+  size_t size() const {
+    const int32_t pages = alloc->get_current_page();
+    return pages > 0 ? size_t(pages) * page_size : 0;
+  }
+  uint8_t *data() const { return alloc->get_base_ptr<uint8_t>(); }
+};
+
+// Host functions are bound straight to the generic EEI methods, which take
+// offsets into linear memory like the imports do.
+class EOSvmEthereumInterface : public EthereumInterface<EOSvmMemory> {
 public:
-  explicit EOSvmEthereumInterface(evmc::HostContext &_context, bytes_view _code,
-                                  evmc_message const &_msg,
+  explicit EOSvmEthereumInterface(evmc::HostInterface &_context,
+                                  bytes_view _code, evmc_message const &_msg,
                                   ExecutionResult &_result, bool _meterGas)
       : EthereumInterface(_context, _code, _msg, _result, _meterGas) {}
 
-#if H_DEBUGGING
-  void dbgPrint(char *, uint32_t length);
-  void dbgPrintMem(uint8_t *dp, uint32_t length) {
-    debugPrintMemImpl(false, dp, length);
+  void setAllocator(wasm_allocator *alloc) { m_memory.alloc = alloc; }
+
+  // The call imports take different parameters, so each has its own entry
+  // into eeiCall.
+  uint32_t eeiCallPlain(int64_t gas, uint32_t addressOffset,
+                        uint32_t valueOffset, uint32_t dataOffset,
+                        uint32_t dataLength) {
+    return eeiCall(EEICallKind::Call, gas, addressOffset, valueOffset,
+                   dataOffset, dataLength);
   }
-  void dbgPrintMemHex(uint8_t *dp, uint32_t length) {
-    debugPrintMemImpl(true, dp, length);
+  uint32_t eeiCallCode(int64_t gas, uint32_t addressOffset,
+                       uint32_t valueOffset, uint32_t dataOffset,
+                       uint32_t dataLength) {
+    return eeiCall(EEICallKind::CallCode, gas, addressOffset, valueOffset,
+                   dataOffset, dataLength);
+  }
+  uint32_t eeiCallDelegate(int64_t gas, uint32_t addressOffset,
+                           uint32_t dataOffset, uint32_t dataLength) {
+    return eeiCall(EEICallKind::CallDelegate, gas, addressOffset, 0,
+                   dataOffset, dataLength);
+  }
+  uint32_t eeiCallStatic(int64_t gas, uint32_t addressOffset,
+                         uint32_t dataOffset, uint32_t dataLength) {
+    return eeiCall(EEICallKind::CallStatic, gas, addressOffset, 0, dataOffset,
+                   dataLength);
   }
-  void dbgPrintStorage(uint8_t *dp) { debugPrintStorageImpl(false, dp); }
-  void dbgPrintStorageHex(uint8_t *dp) { debugPrintStorageImpl(true, dp); }
-#endif
-  void eGetAddress(uint8_t *result);
-  void eStorageStore(bytes32 *path, bytes32 *valuePtr);
-  void eStorageLoad(bytes32 *path, bytes32 *result);
-  void eGetCaller(uint8_t *result);
-  void eSelfDestruct(address *result);
-  void eCallDataCopy(uint8_t *result, uint32_t dataOffset, uint32_t length);
-  void eFinish(void *dp, uint32_t siz) { eRevertOrFinish(false, dp, siz); }
-  void eRevert(void *dp, uint32_t siz) { eRevertOrFinish(true, dp, siz); }
 
-private:
-#if H_DEBUGGING
-  void debugPrintMemImpl(bool, uint8_t *, uint32_t);
-  void debugPrintStorageImpl(bool, uint8_t *);
-#endif
-  void eRevertOrFinish(bool revert, void *dp, uint32_t size);
-  size_t memorySize() const override { return 0; }
-  void memorySet(size_t offset, uint8_t value) override {}
-  uint8_t memoryGet(size_t offset) override { return 0; }
-  uint8_t *memoryPointer(size_t offset, size_t length) override {
-    return nullptr;
+  // Bound instead of the imports that change state when the module executes
+  // static calls, so writes are rejected when binding rather than checked on
+  // every call.
+  void eeiRejectWrite() {
+    ensureCondition(false, StaticModeViolation, "write in a static call");
   }
-};
 
 #if H_DEBUGGING
-void EOSvmEthereumInterface::dbgPrint(char *dp, uint32_t length) {
-  H_DEBUG << depthToString() << " DEBUG print: ";
-  {
-    cerr << hex;
-    for (uint32_t i = 0; i < length; i++) {
-      cerr << dp[i];
-    }
-    cerr << dec;
+  void dbgPrintMem(uint32_t offset, uint32_t length) {
+    debugPrintMem(false, offset, length);
   }
-  H_DEBUG << endl;
-}
-
-void EOSvmEthereumInterface::debugPrintMemImpl(bool useHex, uint8_t *dp,
-                                               uint32_t length) {
-  cerr << depthToString() << " DEBUG printMem" << (useHex ? "Hex(" : "(") << hex
-       << "0x" << (uint32_t)((uint64_t)dp) << ":0x" << length << "): " << dec;
-  if (useHex) {
-    cerr << hex;
+  void dbgPrintMemHex(uint32_t offset, uint32_t length) {
+    debugPrintMem(true, offset, length);
   }
-  for (uint32_t i = 0; i < length; i++) {
-    cerr << dp[i] << " ";
+  void dbgPrintStorage(uint32_t pathOffset) {
+    debugPrintStorage(false, pathOffset);
   }
-  if (useHex) {
-    cerr << dec;
+  void dbgPrintStorageHex(uint32_t pathOffset) {
+    debugPrintStorage(true, pathOffset);
   }
-  cerr << endl;
-}
+#endif
+};
 
-void EOSvmEthereumInterface::debugPrintStorageImpl(bool useHex, uint8_t *dp) {
-  evmc_uint256be path;
-  memcpy(&path, dp, sizeof(path));
+// A compiled module and how its imports are bound.
+struct CompiledModule {
+  unique_ptr<backend_t> bkend;
+  // Cold code parsed for the interpreter, kept instead of bkend until the
+  // code is compiled.
+  unique_ptr<interpreter_t> interpreted;
+  // The costs its metering charges, see meteringId().
+  uint64_t metering = 0;
+  // The import table bound for static calls, resolved along with the
+  // module's own table so that switching between them swaps a pointer.
+  vector<uint32_t> staticImports;
+  // Bound for static calls, which may not write.
+  bool readOnly = false;
+};
 
-  H_DEBUG << depthToString() << " DEBUG printStorage" << (useHex ? "Hex" : "")
-          << "(0x" << hex;
+struct EOSvmEngine::ModuleCache : CodeCache<CompiledModule> {
+  using CodeCache::CodeCache;
+};
 
-  // Print out the path
-  for (uint8_t b : path.bytes)
-    cerr << static_cast<int>(b);
+struct EOSvmEngine::Tiering {
+  // Bounds the memory spent on counting executions of cold code.
+  static constexpr size_t maxTrackedCode = 64 * 1024;
+
+  Tiering(uint32_t _threshold, unsigned threads)
+      : threshold(_threshold), workers(threads) {}
+
+  uint32_t threshold;
+  // Executions of code that is not compiled yet, by code digest.
+  unordered_map<uint64_t, uint32_t> executions;
+  // Code submitted to the workers and not adopted yet.
+  unordered_set<uint64_t> pending;
+  // Modules compiled by the workers, guarded by readyLock. A module that
+  // failed to compile has no value.
+  std::mutex readyLock;
+  vector<ModuleCache::Item> ready;
+  // Declared last so that the workers stop before the rest is destroyed.
+  WorkerPool workers;
+};
 
-  H_DEBUG << "): " << dec;
+namespace {
+// Adds the EEI to the registry shared by all engines, with the same imports as
+// the wabt engine. Only called once, the registry maps imports to the same
+// functions for every execution.
+void registerHostFunctions() {
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiUseGas,
+             wasm_allocator>(ethMod, "useGas");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiGetAddress,
+             wasm_allocator>(ethMod, "getAddress");
+  rhf_t::add<EOSvmEthereumInterface,
+             &EOSvmEthereumInterface::eeiGetExternalBalance, wasm_allocator>(
+      ethMod, "getExternalBalance");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiGetBlockHash,
+             wasm_allocator>(ethMod, "getBlockHash");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiCallPlain,
+             wasm_allocator>(ethMod, "call");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiCallDataCopy,
+             wasm_allocator>(ethMod, "callDataCopy");
+  rhf_t::add<EOSvmEthereumInterface,
+             &EOSvmEthereumInterface::eeiGetCallDataSize, wasm_allocator>(
+      ethMod, "getCallDataSize");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiCallCode,
+             wasm_allocator>(ethMod, "callCode");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiCallDelegate,
+             wasm_allocator>(ethMod, "callDelegate");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiCallStatic,
+             wasm_allocator>(ethMod, "callStatic");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiStorageStore,
+             wasm_allocator>(ethMod, "storageStore");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiStorageLoad,
+             wasm_allocator>(ethMod, "storageLoad");
+  rhf_t::add<EOSvmEthereumInterface,
+             &EOSvmEthereumInterface::eeiStorageStoreMulti, wasm_allocator>(
+      ethMod, "storageStoreMulti");
+  rhf_t::add<EOSvmEthereumInterface,
+             &EOSvmEthereumInterface::eeiStorageLoadMulti, wasm_allocator>(
+      ethMod, "storageLoadMulti");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiGetCaller,
+             wasm_allocator>(ethMod, "getCaller");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiGetCallValue,
+             wasm_allocator>(ethMod, "getCallValue");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiCodeCopy,
+             wasm_allocator>(ethMod, "codeCopy");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiGetCodeSize,
+             wasm_allocator>(ethMod, "getCodeSize");
+  rhf_t::add<EOSvmEthereumInterface,
+             &EOSvmEthereumInterface::eeiGetBlockCoinbase, wasm_allocator>(
+      ethMod, "getBlockCoinbase");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiCreate,
+             wasm_allocator>(ethMod, "create");
+  rhf_t::add<EOSvmEthereumInterface,
+             &EOSvmEthereumInterface::eeiGetBlockDifficulty, wasm_allocator>(
+      ethMod, "getBlockDifficulty");
+  rhf_t::add<EOSvmEthereumInterface,
+             &EOSvmEthereumInterface::eeiExternalCodeCopy, wasm_allocator>(
+      ethMod, "externalCodeCopy");
+  rhf_t::add<EOSvmEthereumInterface,
+             &EOSvmEthereumInterface::eeiGetExternalCodeSize, wasm_allocator>(
+      ethMod, "getExternalCodeSize");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiGetGasLeft,
+             wasm_allocator>(ethMod, "getGasLeft");
+  rhf_t::add<EOSvmEthereumInterface,
+             &EOSvmEthereumInterface::eeiGetBlockGasLimit, wasm_allocator>(
+      ethMod, "getBlockGasLimit");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiGetTxGasPrice,
+             wasm_allocator>(ethMod, "getTxGasPrice");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiLog,
+             wasm_allocator>(ethMod, "log");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiGetBlockNumber,
+             wasm_allocator>(ethMod, "getBlockNumber");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiGetTxOrigin,
+             wasm_allocator>(ethMod, "getTxOrigin");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiFinish,
+             wasm_allocator>(ethMod, "finish");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiRevert,
+             wasm_allocator>(ethMod, "revert");
+  rhf_t::add<EOSvmEthereumInterface,
+             &EOSvmEthereumInterface::eeiGetReturnDataSize, wasm_allocator>(
+      ethMod, "getReturnDataSize");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiReturnDataCopy,
+             wasm_allocator>(ethMod, "returnDataCopy");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiSelfDestruct,
+             wasm_allocator>(ethMod, "selfDestruct");
+  rhf_t::add<EOSvmEthereumInterface,
+             &EOSvmEthereumInterface::eeiGetBlockTimestamp, wasm_allocator>(
+      ethMod, "getBlockTimestamp");
+  for (auto name :
+       {"storageStore", "storageStoreMulti", "log", "create", "selfDestruct"})
+    rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiRejectWrite,
+               wasm_allocator>(ethMod + staticVariant, name);
+#if H_DEBUGGING
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::debugPrint,
+             wasm_allocator>(dbgMod, "print");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::debugPrint32,
+             wasm_allocator>(dbgMod, "print32");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::debugPrint64,
+             wasm_allocator>(dbgMod, "print64");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::dbgPrintMem,
+             wasm_allocator>(dbgMod, "printMem");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::dbgPrintMemHex,
+             wasm_allocator>(dbgMod, "printMemHex");
+  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::dbgPrintStorage,
+             wasm_allocator>(dbgMod, "printStorage");
+  rhf_t::add<EOSvmEthereumInterface,
+             &EOSvmEthereumInterface::dbgPrintStorageHex, wasm_allocator>(
+      dbgMod, "printStorageHex");
+#endif
+}
 
-  evmc_bytes32 result = m_host.get_storage(m_msg.destination, path);
+// Linear memory reservations of the calling thread, one per call depth. Each
+// wasm_allocator maps the whole address range linear memory may grow into, so
+// they are kept and reset between executions instead of being mapped for
+// every call.
+class MemoryPool {
+public:
+  MemoryPool() = default;
+  MemoryPool(MemoryPool const &) = delete;
+  MemoryPool &operator=(MemoryPool const &) = delete;
 
-  if (useHex) {
-    cerr << hex;
-    for (uint8_t b : result.bytes)
-      cerr << static_cast<int>(b) << " ";
-    cerr << dec;
-  } else {
-    for (uint8_t b : result.bytes)
-      cerr << b << " ";
+  ~MemoryPool() {
+    for (auto &alloc : m_allocators)
+      alloc->free();
   }
-  cerr << endl;
-}
-#endif
 
-void EOSvmEthereumInterface::eCallDataCopy(uint8_t *result, uint32_t dataOffset,
-                                           uint32_t length) {
-#if H_DEBUGGING
-  H_DEBUG << depthToString() << " callDataCopy " << hex
-          << (uint32_t)((uint64_t)result) << " " << dataOffset << " " << length
-          << dec << "\n";
-#endif
-  if (dataOffset >= m_msg.input_size)
-    return; // no copy
+  // Returns the allocator for the next call depth. The backend resets it when
+  // it initializes the instance.
+  wasm_allocator &acquire() {
+    if (m_depth == m_allocators.size())
+      m_allocators.push_back(make_unique<wasm_allocator>());
+    return *m_allocators[m_depth++];
+  }
 
-  safeChargeDataCopy(length, GasSchedule::verylow);
+  void release() { --m_depth; }
 
-  if (dataOffset + length > m_msg.input_size)
-    length = m_msg.input_size - dataOffset;
-  memcpy(result, m_msg.input_data + dataOffset, length);
-}
+private:
+  vector<unique_ptr<wasm_allocator>> m_allocators;
+  size_t m_depth = 0;
+};
 
-void EOSvmEthereumInterface::eGetCaller(uint8_t *result) {
-  H_DEBUG << depthToString() << " getCaller " << hex
-          << (uint32_t)((uint64_t)result) << dec << "\n";
+thread_local MemoryPool memoryPool;
 
-  takeInterfaceGas(GasSchedule::base);
-  memcpy(result, &m_msg.sender, sizeof(m_msg.sender));
+// Serves the time limits of the engines of all threads from one timer thread.
+watchdog_service &watchdogs() {
+  static watchdog_service service;
+  return service;
 }
 
-void EOSvmEthereumInterface::eGetAddress(uint8_t *result) {
-  H_DEBUG << depthToString() << " getAddress " << hex
-          << (uint32_t)((uint64_t)result) << dec << "\n";
+// Returns the digest of a cost table, which is never zero, so it does not
+// match modules compiled without metering.
+uint64_t costsDigest(InstructionCosts const &costs) {
+  const uint64_t digest = codeDigest(
+      bytes_view{reinterpret_cast<uint8_t const *>(costs.data()),
+                 costs.size() * sizeof(costs[0])});
+  return digest ? digest : 1;
+}
 
-  takeInterfaceGas(GasSchedule::base);
-  memcpy(result, &m_msg.destination, sizeof(m_msg.destination));
+// Compiles @code, charging @costs for its instructions unless it is
+// unmetered. Polled code can be stopped by the time limit.
+unique_ptr<backend_t> compile(bytes_view code, bool metered,
+                              InstructionCosts const &costs, bool polled) {
+  wasm_code_ptr wcodePtr((uint8_t *)code.data(), code.size());
+  const gas_costs gas{costs};
+  return make_unique<backend_t>(
+      wcodePtr, code.size(), jit_options{metered ? &gas : nullptr, polled});
 }
 
-void EOSvmEthereumInterface::eSelfDestruct(address *result) {
-  H_DEBUG << depthToString() << " selfDestruct " << hex
-          << (uint32_t)((uint64_t)result) << dec << "\n";
+// Resolves the imports of a new module for both other and static calls, and
+// binds it for other calls.
+template <typename Backend>
+void resolveImports(Backend &bkend, CompiledModule &compiled) {
+  auto &mod = bkend.get_module();
+  rhf_t::resolve(mod);
+  compiled.staticImports = rhf_t::resolve_imports(mod, staticVariant);
+  mod.finalize();
+  compiled.readOnly = false;
+}
 
-  takeInterfaceGas(GasSchedule::balance);
-  m_host.selfdestruct(m_msg.destination, *result);
-  throw EndExecution{};
+// Binds the import table of @compiled for static calls or other calls.
+template <typename Backend>
+void bindImports(Backend &bkend, CompiledModule &compiled, bool readOnly) {
+  if (compiled.readOnly == readOnly)
+    return;
+  bkend.get_module().bind_imports(
+      readOnly ? compiled.staticImports.data() : nullptr);
+  compiled.readOnly = readOnly;
 }
 
-void EOSvmEthereumInterface::eStorageStore(bytes32 *path, bytes32 *valuePtr) {
-  H_DEBUG << depthToString() << " storageStore " << hex
-          << (uint32_t)((uint64_t)path) << " " << (uint32_t)((uint64_t)valuePtr)
-          << dec << "\n";
+// Memory held by a compiled module: the parsed module and its JIT code.
+template <typename Backend> size_t moduleFootprint(Backend &bkend) {
+  const auto &alloc = bkend.get_module().allocator;
+  return alloc._capacity + alloc._code_size;
+}
 
-  // Charge this here as it is the minimum cost.
-  takeInterfaceGas(GasSchedule::storageStoreChange);
+// Compiled modules persisted to disk start with this magic and the ID of the
+// build that wrote them, followed by the metering ID of the module, the
+// contract code and the jit image.
+constexpr char jitFileMagic[] = "athena-eosvm-jit";
 
-  ensureCondition(!(m_msg.flags & EVMC_STATIC), StaticModeViolation,
-                  "storageStore");
+// Code generated by another build may differ, so its images are ignored.
+string buildId() {
+  return string(athena_get_buildinfo()->project_version) + "+" +
+         athena_get_buildinfo()->git_commit_hash + " " + __DATE__ " " __TIME__;
+}
 
-  const auto current = m_host.get_storage(m_msg.destination, *path);
+string jitImagePath(string const &dir, bytes_view code) {
+  ostringstream os;
+  os << dir << "/" << hex << setfill('0') << setw(16) << codeDigest(code)
+     << ".eosvm";
+  return os.str();
+}
 
-  // Charge the right amount in case of the create case.
-  if (is_zero(current) && !is_zero(*valuePtr))
-    takeInterfaceGas(GasSchedule::storageStoreCreate -
-                     GasSchedule::storageStoreChange);
+template <typename T> void appendRaw(vector<uint8_t> &out, T const &value) {
+  auto p = reinterpret_cast<uint8_t const *>(&value);
+  out.insert(out.end(), p, p + sizeof(T));
+}
 
-  // We do not need to take care about the delete case (gas refund), the client
-  // does it.
+void storeJitImage(string const &dir, bytes_view code, backend_t &bkend,
+                   uint64_t metering) {
+  const string id = buildId();
+  vector<uint8_t> contents(jitFileMagic, jitFileMagic + sizeof(jitFileMagic));
+  appendRaw<uint32_t>(contents, id.size());
+  contents.insert(contents.end(), id.begin(), id.end());
+  appendRaw<uint64_t>(contents, metering);
+  appendRaw<uint64_t>(contents, code.size());
+  contents.insert(contents.end(), code.begin(), code.end());
+  if (!write_jit_image(bkend.get_module(), contents))
+    return;
+  if (!storeFileContents(jitImagePath(dir, code),
+                         bytes_view{contents.data(), contents.size()}))
+    H_DEBUG << "Failed to store compiled module in " << dir << "\n";
+}
 
-  m_host.set_storage(m_msg.destination, *path, *valuePtr);
+// Returns nullptr unless @image holds a module with the requested metering,
+// which charges the costs identified by @metering if it is metered, and that
+// polls for interrupts if @polled is set.
+unique_ptr<backend_t> fromJitImage(bytes_view image, uint64_t metering,
+                                   bool polled) {
+  try {
+    auto ret =
+        make_unique<backend_t>(from_jit_image, image.data(), image.size());
+    if (ret->get_module().gas_metered != (metering != 0) ||
+        ret->get_module().interrupt_polled != polled)
+      return nullptr;
+    return ret;
+  } catch (const eosio::vm::exception &ex) {
+    H_DEBUG << "Invalid compiled module: " << ex.what() << " : "
+            << ex.detail() << "\n";
+    return nullptr;
+  }
 }
 
-void EOSvmEthereumInterface::eStorageLoad(bytes32 *path, bytes32 *result) {
-  H_DEBUG << depthToString() << " storageLoad " << hex
-          << (uint32_t)((uint64_t)path) << " " << (uint32_t)((uint64_t)result)
-          << dec << "\n";
+// Returns nullptr unless the image for @code was stored by this build, with
+// the requested metering and polls.
+unique_ptr<backend_t> loadJitImage(string const &dir, bytes_view code,
+                                   uint64_t metering, bool polled) {
+  int fd = open(jitImagePath(dir, code).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return nullptr;
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+    map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return nullptr;
+  auto unmap = scope_guard{[&]() { munmap(map, st.st_size); }};
+
+  bytes_view contents{static_cast<uint8_t const *>(map),
+                      static_cast<size_t>(st.st_size)};
+  auto consume = [&contents](size_t size) {
+    bytes_view ret = contents.substr(0, size);
+    contents.remove_prefix(ret.size());
+    return ret;
+  };
+  auto consumeSize = [&consume](auto size) {
+    bytes_view raw = consume(sizeof(size));
+    if (raw.size() == sizeof(size))
+      memcpy(&size, raw.data(), sizeof(size));
+    return size;
+  };
+
+  const string id = buildId();
+  if (consume(sizeof(jitFileMagic)) !=
+      bytes_view{reinterpret_cast<uint8_t const *>(jitFileMagic),
+                 sizeof(jitFileMagic)})
+    return nullptr;
+  if (consume(consumeSize(uint32_t{0})) !=
+      bytes_view{reinterpret_cast<uint8_t const *>(id.data()), id.size()})
+    return nullptr;
+  if (consumeSize(uint64_t{0}) != metering)
+    return nullptr;
+  if (consume(consumeSize(uint64_t{0})) != code)
+    return nullptr;
 
-  takeInterfaceGas(GasSchedule::storageLoad);
+  auto ret = fromJitImage(contents, metering, polled);
+#if H_DEBUGGING
+  if (ret)
+    H_DEBUG << "Loaded compiled eosvm module from " << dir << "\n";
+#endif
+  return ret;
+}
 
-  *result = m_host.get_storage(m_msg.destination, *path);
+// Shares the jit image of @bkend with the engines of other threads. Shared
+// images start with the metering ID of the module.
+void shareJitImage(CompiledCodeCache &shared, bytes_view code,
+                   backend_t &bkend, uint64_t metering) {
+  vector<uint8_t> image;
+  appendRaw<uint64_t>(image, metering);
+  if (!write_jit_image(bkend.get_module(), image))
+    return;
+  auto value = make_shared<bytes const>(image.begin(), image.end());
+  shared.put({bytes{code}, value, value->size()});
+}
+} // namespace
+
+EOSvmEngine::EOSvmEngine() : m_modules(make_unique<ModuleCache>()) {
+  static const bool registered = (registerHostFunctions(), true);
+  (void)registered;
+  InstructionCosts costs;
+  costs.fill(1);
+  setInstructionCosts(costs);
 }
 
-void EOSvmEthereumInterface::eRevertOrFinish(bool revert, void *dp,
-                                             uint32_t size) {
-#if H_DEBUGGING
-  H_DEBUG << depthToString() << " " << (revert ? "revert " : "finish ") << hex
-          << (uint32_t)((uint64_t)dp) << " " << size << dec << "\n";
-#endif
+EOSvmEngine::~EOSvmEngine() noexcept = default;
+
+unique_ptr<WasmEngine> EOSvmEngine::create() {
+  return unique_ptr<WasmEngine>{new EOSvmEngine};
+}
+
+void EOSvmEngine::setModuleCacheBudget(size_t budget) {
+  m_modules->setBudget(budget);
+}
 
-  m_result.returnValue = bytes(size, '\0');
-  memcpy(m_result.returnValue.data(), dp, size);
+void EOSvmEngine::setCompiledCodeCache(CompiledCodeCache *cache) {
+  m_compiledCode = cache;
+}
 
-  m_result.isRevert = revert;
+void EOSvmEngine::setCacheDirectory(string const &dir) { m_cacheDir = dir; }
 
-  throw EndExecution{};
+void EOSvmEngine::setTimeLimit(chrono::milliseconds limit) {
+  m_timeLimit = limit;
 }
 
-unique_ptr<WasmEngine> EOSvmEngine::create() {
-  return unique_ptr<WasmEngine>{new EOSvmEngine};
+void EOSvmEngine::setInstructionCosts(InstructionCosts const &costs) {
+  m_costs = costs;
+  m_costsDigest = costsDigest(costs);
 }
 
-ExecutionResult EOSvmEngine::execute(evmc::HostContext &context,
+ExecutionResult EOSvmEngine::execute(evmc::HostInterface &context,
                                      bytes_view code, bytes_view state_code,
                                      evmc_message const &msg,
-                                     bool meterInterfaceGas) {
-
-  wasm_allocator wa;
-  using rhf_t = eosio::vm::registered_host_functions<EOSvmEthereumInterface>;
+                                     bool meterInterfaceGas,
+                                     bool meterInstructions) {
 #if H_DEBUGGING
   H_DEBUG << "Executing with eosvm...\n";
 #endif
   instantiationStarted();
-
-  // register eth_finish
-  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eFinish,
-             wasm_allocator>(ethMod, "finish");
-  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eRevert,
-             wasm_allocator>(ethMod, "revert");
-  // register eth_getCallDataSize
-  rhf_t::add<EOSvmEthereumInterface,
-             &EOSvmEthereumInterface::eeiGetCallDataSize, wasm_allocator>(
-      ethMod, "getCallDataSize");
-  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eCallDataCopy,
-             wasm_allocator>(ethMod, "callDataCopy");
-  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eGetAddress,
-             wasm_allocator>(ethMod, "getAddress");
-  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eStorageStore,
-             wasm_allocator>(ethMod, "storageStore");
-  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eStorageLoad,
-             wasm_allocator>(ethMod, "storageLoad");
-  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eGetCaller,
-             wasm_allocator>(ethMod, "getCaller");
-  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eSelfDestruct,
-             wasm_allocator>(ethMod, "selfDestruct");
+  if (m_tiering)
+    adoptCompiledModules();
+
+  // Static calls may not change state, so their modules bind the imports
+  // that would to a function rejecting them.
+  const bool readOnly = msg.flags & EVMC_STATIC;
+  const uint64_t metering = meteringId(meterInstructions);
+  const bool polls = polled();
+
+  // Skip parsing and code generation if this code was compiled before. The
+  // module is checked out for the duration of the call, so a reentrant call
+  // into the same code compiles its own copy. A module compiled with other
+  // metering or polls is replaced.
+  ModuleCache::Item compiled;
+  auto cached = m_modules->take(code);
+  if (cached && cached->value.bkend &&
+      cached->value.bkend->get_module().interrupt_polled != polls)
+    cached.reset();
+  if (cached && cached->value.metering != metering)
+    cached.reset();
+  if (cached && cached->value.bkend) {
 #if H_DEBUGGING
-  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::dbgPrint,
-             wasm_allocator>(dbgMod, "print");
-  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::debugPrint32,
-             wasm_allocator>(dbgMod, "print32");
-  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::debugPrint64,
-             wasm_allocator>(dbgMod, "print64");
-  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::dbgPrintMem,
-             wasm_allocator>(dbgMod, "printMem");
-  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::dbgPrintMemHex,
-             wasm_allocator>(dbgMod, "printMemHex");
-  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::dbgPrintStorage,
-             wasm_allocator>(dbgMod, "printStorage");
-  rhf_t::add<EOSvmEthereumInterface,
-             &EOSvmEthereumInterface::dbgPrintStorageHex, wasm_allocator>(
-      dbgMod, "printStorageHex");
+    H_DEBUG << "Using cached eosvm module (" << cached->code.size()
+            << " bytes)\n";
 #endif
-  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiUseGas,
-             wasm_allocator>(ethMod, "useGas");
-  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiGetGasLeft,
-             wasm_allocator>(ethMod, "getGasLeft");
-  rhf_t::add<EOSvmEthereumInterface, &EOSvmEthereumInterface::eeiGetBlockNumber,
-             wasm_allocator>(ethMod, "getBlockNumber");
+    compiled = move(*cached);
+  } else {
+    // Another thread may have compiled it already.
+    bool shared = false;
+    if (m_compiledCode) {
+      if (auto image = m_compiledCode->get(code)) {
+        bytes_view imageView{**image};
+        if (imageView.size() >= sizeof(metering) &&
+            memcmp(imageView.data(), &metering, sizeof(metering)) == 0)
+          compiled.value.bkend =
+              fromJitImage(imageView.substr(sizeof(metering)), metering, polls);
+      }
+      shared = compiled.value.bkend != nullptr;
+    }
+    if (!compiled.value.bkend && !m_cacheDir.empty())
+      compiled.value.bkend = loadJitImage(m_cacheDir, code, metering, polls);
+    if (!compiled.value.bkend && m_tiering) {
+      // Cold code is interpreted until it has run often enough to be
+      // compiled in the background. It is parsed and resolved once and kept
+      // in the module cache until the compiled module replaces it.
+      countExecution(code, meterInstructions);
 #if H_DEBUGGING
-  H_DEBUG << "Reading ewasm with eosvm...\n";
+      H_DEBUG << "Interpreting ewasm with eosvm...\n";
 #endif
-  wasm_code_ptr wcodePtr((uint8_t *)code.data(), code.size());
-  // wasm_code wcode(code.begin(), code.end());
-  backend_t bkend(wcodePtr, code.size());
-  bkend.set_wasm_allocator(&wa);
+      if (cached) {
+        compiled = move(*cached);
+      } else {
+        wasm_code_ptr wcodePtr((uint8_t *)code.data(), code.size());
+        if (meterInstructions)
+          compiled.value.interpreted = make_unique<interpreter_t>(
+              wcodePtr, code.size(), gas_costs{m_costs});
+        else
+          compiled.value.interpreted =
+              make_unique<interpreter_t>(wcodePtr, code.size());
+        compiled.value.metering = metering;
+        resolveImports(*compiled.value.interpreted, compiled.value);
+        compiled.code = bytes{code};
+        compiled.cost = moduleFootprint(*compiled.value.interpreted);
+      }
+      bindImports(*compiled.value.interpreted, compiled.value, readOnly);
+      // A nested call may have adopted the compiled module meanwhile, which
+      // the interpreted one must not replace.
+      auto checkin = scope_guard{[&]() {
+        if (!m_modules->contains(compiled.code))
+          m_modules->put(move(compiled));
+      }};
+      return run(*compiled.value.interpreted, context, state_code, msg,
+                 meterInterfaceGas);
+    }
+    if (!compiled.value.bkend) {
+#if H_DEBUGGING
+      H_DEBUG << "Reading ewasm with eosvm...\n";
+#endif
+      compiled.value.bkend = compile(code, meterInstructions, m_costs, polls);
+      if (!m_cacheDir.empty())
+        storeJitImage(m_cacheDir, code, *compiled.value.bkend, metering);
+    }
+    if (m_compiledCode && !shared)
+      shareJitImage(*m_compiledCode, code, *compiled.value.bkend, metering);
+    compiled.value.metering = metering;
 
 #if H_DEBUGGING
-  H_DEBUG << "Resolving ewasm with eosvm...\n";
+    H_DEBUG << "Resolving ewasm with eosvm...\n";
 #endif
-  rhf_t::resolve(bkend.get_module());
-  bkend.get_module().finalize();
+    resolveImports(*compiled.value.bkend, compiled.value);
+    compiled.value.bkend->enable_memory_snapshot();
+    compiled.code = bytes{code};
+    compiled.cost = moduleFootprint(*compiled.value.bkend);
+  }
+  bindImports(*compiled.value.bkend, compiled.value, readOnly);
+  // Hand the module back to the cache however the execution ends.
+  auto checkin = scope_guard{[&]() { m_modules->put(move(compiled)); }};
+
+  return run(*compiled.value.bkend, context, state_code, msg,
+             meterInterfaceGas);
+}
+
+template <typename Backend>
+ExecutionResult EOSvmEngine::run(Backend &bkend, evmc::HostInterface &context,
+                                 bytes_view state_code,
+                                 evmc_message const &msg,
+                                 bool meterInterfaceGas) {
+  wasm_allocator &wa = memoryPool.acquire();
+  auto release = scope_guard{[]() { memoryPool.release(); }};
+  bkend.set_wasm_allocator(&wa);
   bkend.initialize();
 #if H_DEBUGGING
   H_DEBUG << "Resolved with eosvm...\n";
@@ -325,12 +647,25 @@ ExecutionResult EOSvmEngine::execute(evmc::HostContext &context,
                           // meterInterfaceGas);
   EOSvmEthereumInterface interface{context, state_code, msg, result,
                                    meterInterfaceGas};
+  interface.setAllocator(&wa);
+  // Metered code charges the same gas the interface does.
+  bkend.set_gas_counter(&result.gasLeft);
+  auto uncount = scope_guard{[&bkend]() { bkend.set_gas_counter(nullptr); }};
   executionStarted();
   try {
     uint32_t main_idx = bkend.get_module().get_exported_function("main");
     // bkend.execute_all(null_watchdog());
     // bkend.call(&interface, "test", "main");
-    auto res = bkend.call(&interface, main_idx);
+    bool res = false;
+    auto invoke = [&]() { res = bkend.call(&interface, main_idx); };
+    // Jit code compiled under a time limit polls for the interrupt, which
+    // spares the other threads the page protection changes timed_run makes.
+    if (m_timeLimit.count() == 0)
+      invoke();
+    else if constexpr (is_same_v<Backend, backend_t>)
+      bkend.polled_run(shared_watchdog{watchdogs(), m_timeLimit}, invoke);
+    else
+      bkend.timed_run(shared_watchdog{watchdogs(), m_timeLimit}, invoke);
     // Wrap any non-EEI exception under VMTrap.
     ensureCondition(res, VMTrap, "The VM invocation had a trap.");
   } catch (wasm_exit_exception const &) {
@@ -341,6 +676,10 @@ ExecutionResult EOSvmEngine::execute(evmc::HostContext &context,
   } catch (EndExecution const &) {
     // This exception is ignored here because we consider it to be a success.
     // It is only a clutch for eth_finish() and eth_revert()
+  } catch (out_of_gas_exception const &) {
+    ensureCondition(false, OutOfGas, "Out of gas.");
+  } catch (timeout_exception const &) {
+    ensureCondition(false, VMTrap, "Execution timed out.");
   } catch (const eosio::vm::exception &ex) {
     std::cerr << "eos-vm interpreter error\n";
     std::cerr << ex.what() << " : " << ex.detail() << "\n";
@@ -351,4 +690,67 @@ ExecutionResult EOSvmEngine::execute(evmc::HostContext &context,
   return result;
 }
 
+void EOSvmEngine::setTiering(uint32_t threshold, unsigned threads) {
+  if (threshold == 0 || threads == 0) {
+    m_tiering.reset();
+  } else if (m_tiering && m_tiering->workers.size() == threads) {
+    m_tiering->threshold = threshold;
+  } else {
+    m_tiering = make_unique<Tiering>(threshold, threads);
+  }
+}
+
+void EOSvmEngine::countExecution(bytes_view code, bool metered) {
+  Tiering &tiering = *m_tiering;
+  const uint64_t digest = codeDigest(code);
+  if (tiering.executions.size() >= Tiering::maxTrackedCode)
+    tiering.executions.clear();
+  if (++tiering.executions[digest] < tiering.threshold ||
+      tiering.pending.count(digest))
+    return;
+
+#if H_DEBUGGING
+  H_DEBUG << "Compiling hot eosvm module in the background\n";
+#endif
+  tiering.executions.erase(digest);
+  tiering.pending.insert(digest);
+  tiering.workers.submit(
+      [&tiering, code = bytes{code}, dir = m_cacheDir,
+       shared = m_compiledCode, metered, costs = m_costs,
+       metering = meteringId(metered), polls = polled()]() mutable {
+        ModuleCache::Item item;
+        item.value.metering = metering;
+        try {
+          item.value.bkend = compile(code, metered, costs, polls);
+          if (!dir.empty())
+            storeJitImage(dir, code, *item.value.bkend, metering);
+          if (shared)
+            shareJitImage(*shared, code, *item.value.bkend, metering);
+        } catch (std::exception const &ex) {
+          H_DEBUG << "Background compilation failed: " << ex.what() << "\n";
+          item.value.bkend.reset();
+        }
+        item.code = move(code);
+        lock_guard<std::mutex> lock(tiering.readyLock);
+        tiering.ready.push_back(move(item));
+      });
+}
+
+void EOSvmEngine::adoptCompiledModules() {
+  vector<ModuleCache::Item> ready;
+  {
+    lock_guard<std::mutex> lock(m_tiering->readyLock);
+    ready.swap(m_tiering->ready);
+  }
+  for (auto &item : ready) {
+    m_tiering->pending.erase(codeDigest(item.code));
+    if (!item.value.bkend)
+      continue;
+    resolveImports(*item.value.bkend, item.value);
+    item.value.bkend->enable_memory_snapshot();
+    item.cost = moduleFootprint(*item.value.bkend);
+    m_modules->put(move(item));
+  }
+}
+
 } // namespace athena
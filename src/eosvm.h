@@ -22,12 +22,58 @@ namespace athena {
 
 class EOSvmEngine : public WasmEngine {
 public:
-  /// Factory method to create the WAVM Wasm Engine.
+  EOSvmEngine();
+  ~EOSvmEngine() noexcept override;
+
+  /// Factory method to create the EOS VM Wasm Engine.
   static std::unique_ptr<WasmEngine> create();
 
-  ExecutionResult execute(evmc::HostContext &context, bytes_view code,
+  ExecutionResult execute(evmc::HostInterface &context, bytes_view code,
                           bytes_view state_code, evmc_message const &msg,
-                          bool meterInterfaceGas) override;
+                          bool meterInterfaceGas,
+                          bool meterInstructions) override;
+
+  void setModuleCacheBudget(size_t budget) override;
+  void setCompiledCodeCache(CompiledCodeCache *cache) override;
+  void setCacheDirectory(std::string const &dir) override;
+  void setTiering(uint32_t threshold, unsigned threads) override;
+  void setTimeLimit(std::chrono::milliseconds limit) override;
+  bool supportsNativeMetering() const noexcept override { return true; }
+  void setInstructionCosts(InstructionCosts const &costs) override;
+
+private:
+  template <typename Backend>
+  ExecutionResult run(Backend &bkend, evmc::HostInterface &context,
+                      bytes_view state_code, evmc_message const &msg,
+                      bool meterInterfaceGas);
+
+  // Counts an execution of cold code and submits it for compilation once it
+  // is hot, with the same metering.
+  void countExecution(bytes_view code, bool metered);
+  // Identifies how modules compiled with or without metering charge gas.
+  uint64_t meteringId(bool metered) const noexcept {
+    return metered ? m_costsDigest : 0;
+  }
+  // Set if compiled code polls for interrupts, which only the time limit
+  // needs.
+  bool polled() const noexcept { return m_timeLimit.count() != 0; }
+  // Moves modules compiled in the background into the module cache.
+  void adoptCompiledModules();
+
+  // Compiled modules by code, defined next to the backend type.
+  struct ModuleCache;
+  std::unique_ptr<ModuleCache> m_modules;
+  CompiledCodeCache *m_compiledCode = nullptr;
+  std::string m_cacheDir;
+  // Gas charged for each instruction by metered modules, and a digest of it
+  // that tells modules compiled with other costs apart.
+  InstructionCosts m_costs;
+  uint64_t m_costsDigest;
+  // Wall-clock time an execution may take, zero for no limit.
+  std::chrono::milliseconds m_timeLimit{0};
+  // Set while tiered execution is enabled.
+  struct Tiering;
+  std::unique_ptr<Tiering> m_tiering;
 };
 
 } // namespace athena
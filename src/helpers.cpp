@@ -14,9 +14,15 @@
  * limitations under the License.
  */
 
+#include <atomic>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
+#include <limits>
 #include <sstream>
+#include <thread>
+#include <unistd.h>
 
 #include <evmc/evmc.h>
 
@@ -32,6 +38,28 @@ bytes loadFileContents(string const &path) {
   return {iterator{is}, iterator{}};
 }
 
+bool storeFileContents(string const &path, bytes_view contents) {
+  // Threads of this and other processes may store the same file at once, so
+  // each write gets a temporary file of its own.
+  static atomic<uint64_t> writes{0};
+  const string tmpPath = path + ".tmp" + to_string(getpid()) + "-" +
+                         to_string(hash<thread::id>{}(this_thread::get_id())) +
+                         "-" + to_string(writes++);
+  {
+    ofstream os{tmpPath, ios::binary | ios::trunc};
+    os.write(reinterpret_cast<char const *>(contents.data()), contents.size());
+    if (!os.flush()) {
+      remove(tmpPath.c_str());
+      return false;
+    }
+  }
+  if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+    remove(tmpPath.c_str());
+    return false;
+  }
+  return true;
+}
+
 string toHex(evmc_uint256be const &value) {
   ostringstream os;
   os << hex;
@@ -96,4 +124,143 @@ bool hasWasmVersion(bytes_view _input, uint8_t _version) {
          _input[6] == 0 && _input[7] == 0;
 }
 
+// MurmurHash64A, with a fixed seed so digests are stable across runs.
+uint64_t codeDigest(bytes_view _input) {
+  constexpr uint64_t m = 0xc6a4a7935bd1e995ULL;
+  constexpr int r = 47;
+  const size_t len = _input.size();
+  uint64_t h = 0x61746865ULL ^ (len * m);
+
+  const uint8_t *data = _input.data();
+  const uint8_t *end = data + (len & ~size_t(7));
+  for (; data != end; data += 8) {
+    uint64_t k;
+    memcpy(&k, data, sizeof(k));
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+
+  switch (len & 7) {
+  case 7:
+    h ^= uint64_t(data[6]) << 48;
+    [[fallthrough]];
+  case 6:
+    h ^= uint64_t(data[5]) << 40;
+    [[fallthrough]];
+  case 5:
+    h ^= uint64_t(data[4]) << 32;
+    [[fallthrough]];
+  case 4:
+    h ^= uint64_t(data[3]) << 24;
+    [[fallthrough]];
+  case 3:
+    h ^= uint64_t(data[2]) << 16;
+    [[fallthrough]];
+  case 2:
+    h ^= uint64_t(data[1]) << 8;
+    [[fallthrough]];
+  case 1:
+    h ^= uint64_t(data[0]);
+    h *= m;
+  }
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+bool parseByteSize(string const &input, size_t &output) {
+  if (input.empty())
+    return false;
+  size_t pos = 0;
+  unsigned long long value;
+  try {
+    value = stoull(input, &pos, 10);
+  } catch (exception const &) {
+    return false;
+  }
+  unsigned shift = 0;
+  if (pos < input.length()) {
+    switch (input[pos++]) {
+    case 'k':
+    case 'K':
+      shift = 10;
+      break;
+    case 'm':
+    case 'M':
+      shift = 20;
+      break;
+    case 'g':
+    case 'G':
+      shift = 30;
+      break;
+    default:
+      return false;
+    }
+  }
+  if (pos != input.length() || input[0] == '-' ||
+      value > (numeric_limits<size_t>::max() >> shift))
+    return false;
+  output = size_t(value) << shift;
+  return true;
+}
+
+bool parseInstructionCosts(string const &input, InstructionCosts &output) {
+  InstructionCosts costs;
+  array<bool, 256> listed{};
+  uint32_t fallback = 1;
+  istringstream is{input};
+  string line;
+  while (getline(is, line)) {
+    line = line.substr(0, line.find('#'));
+    istringstream fields{line};
+    string opcode, cost, rest;
+    if (!(fields >> opcode))
+      continue;
+    uint32_t value;
+    if (!(fields >> cost) || (fields >> rest) || !parseCount(cost, value))
+      return false;
+    if (opcode == "*") {
+      fallback = value;
+      continue;
+    }
+    size_t pos = 0;
+    unsigned long index;
+    try {
+      index = stoul(opcode, &pos, 0);
+    } catch (exception const &) {
+      return false;
+    }
+    if (pos != opcode.length() || opcode[0] == '-' || index >= costs.size())
+      return false;
+    costs[index] = value;
+    listed[index] = true;
+  }
+  for (size_t i = 0; i < costs.size(); i++)
+    if (!listed[i])
+      costs[i] = fallback;
+  output = costs;
+  return true;
+}
+
+bool parseCount(string const &input, uint32_t &output) {
+  if (input.empty() || input[0] == '-')
+    return false;
+  size_t pos = 0;
+  unsigned long long value;
+  try {
+    value = stoull(input, &pos, 10);
+  } catch (exception const &) {
+    return false;
+  }
+  if (pos != input.length() || value > numeric_limits<uint32_t>::max())
+    return false;
+  output = uint32_t(value);
+  return true;
+}
+
 } // namespace athena
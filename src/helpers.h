@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <array>
 #include <string>
 
 #include <evmc/evmc.h>
@@ -27,6 +28,10 @@ using bytes_view = std::basic_string_view<uint8_t>;
 
 bytes loadFileContents(std::string const &path);
 
+// Writes @contents to @path through a temporary file, so readers never see a
+// partially written file. Returns false on failure.
+bool storeFileContents(std::string const &path, bytes_view contents);
+
 std::string toHex(evmc_uint256be const &value);
 
 // Returns a formatted string (with prefix "0x") representing the bytes of an
@@ -39,4 +44,26 @@ bool hasWasmPreamble(bytes_view _input);
 
 bool hasWasmVersion(bytes_view _input, uint8_t _version);
 
+// Returns a 64-bit digest of the input. It is not collision resistant, so
+// anything keyed by it must confirm a match against the full input.
+uint64_t codeDigest(bytes_view _input);
+
+// Parses a byte count with an optional k, m or g suffix (powers of 1024).
+// Returns false if the input is malformed.
+bool parseByteSize(std::string const &input, size_t &output);
+
+// Gas natively metered code is charged for each wasm instruction, indexed by
+// opcode.
+using InstructionCosts = std::array<uint32_t, 256>;
+
+// Parses a cost table with one "<opcode> <cost>" line per instruction, where
+// the opcode is decimal or 0x-prefixed hex, and "*" stands for every opcode
+// not listed. Unlisted opcodes otherwise cost one unit. Text after "#" is a
+// comment. Returns false if the input is malformed.
+bool parseInstructionCosts(std::string const &input, InstructionCosts &output);
+
+// Parses a decimal count. Returns false if the input is malformed or does not
+// fit 32 bits.
+bool parseCount(std::string const &input, uint32_t &output);
+
 } // namespace athena
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2019-2020 Jesse Kuang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host_cache.h"
+
+using namespace evmc::literals;
+
+namespace athena {
+
+namespace {
+// Code hash of accounts without code, which may still get code later.
+constexpr auto emptyCodeHash =
+    0xc5d2460186f7233c927e7db2dcc703c0e500b653ca82273b7bfad8045d85a470_bytes32;
+} // namespace
+
+bool CachingHost::account_exists(evmc::address const &addr) noexcept {
+  if (m_cache.existingAccounts.count(addr))
+    return true;
+  if (!m_host.account_exists(addr))
+    return false;
+  m_cache.existingAccounts.insert(addr);
+  return true;
+}
+
+evmc::bytes32 CachingHost::get_storage(evmc::address const &addr,
+                                       evmc::bytes32 const &key) noexcept {
+  return m_host.get_storage(addr, key);
+}
+
+evmc_storage_status
+CachingHost::set_storage(evmc::address const &addr, evmc::bytes32 const &key,
+                         evmc::bytes32 const &value) noexcept {
+  return m_host.set_storage(addr, key, value);
+}
+
+evmc::uint256be CachingHost::get_balance(evmc::address const &addr) noexcept {
+  return m_host.get_balance(addr);
+}
+
+size_t CachingHost::get_code_size(evmc::address const &addr) noexcept {
+  auto cached = m_cache.codeSizes.find(addr);
+  if (cached != m_cache.codeSizes.end())
+    return cached->second;
+  const size_t size = m_host.get_code_size(addr);
+  if (size != 0)
+    m_cache.codeSizes.emplace(addr, size);
+  return size;
+}
+
+evmc::bytes32 CachingHost::get_code_hash(evmc::address const &addr) noexcept {
+  auto cached = m_cache.codeHashes.find(addr);
+  if (cached != m_cache.codeHashes.end())
+    return cached->second;
+  const evmc::bytes32 hash = m_host.get_code_hash(addr);
+  if (hash != evmc::bytes32{} && hash != emptyCodeHash)
+    m_cache.codeHashes.emplace(addr, hash);
+  return hash;
+}
+
+size_t CachingHost::copy_code(evmc::address const &addr, size_t code_offset,
+                              uint8_t *buffer_data,
+                              size_t buffer_size) noexcept {
+  return m_host.copy_code(addr, code_offset, buffer_data, buffer_size);
+}
+
+void CachingHost::selfdestruct(evmc::address const &addr,
+                               evmc::address const &beneficiary) noexcept {
+  m_host.selfdestruct(addr, beneficiary);
+}
+
+evmc::result CachingHost::call(evmc_message const &msg) noexcept {
+  evmc::result result = m_host.call(msg);
+  // Accounts created below a failed frame are gone again.
+  if (result.status_code != EVMC_SUCCESS)
+    m_cache.clearAccounts();
+  return result;
+}
+
+evmc_tx_context CachingHost::get_tx_context() noexcept {
+  if (!m_cache.txContext)
+    m_cache.txContext = m_host.get_tx_context();
+  return *m_cache.txContext;
+}
+
+evmc::bytes32 CachingHost::get_block_hash(int64_t block_number) noexcept {
+  auto cached = m_cache.blockHashes.find(block_number);
+  if (cached != m_cache.blockHashes.end())
+    return cached->second;
+  const evmc::bytes32 hash = m_host.get_block_hash(block_number);
+  m_cache.blockHashes.emplace(block_number, hash);
+  return hash;
+}
+
+void CachingHost::emit_log(evmc::address const &addr, uint8_t const *data,
+                           size_t data_size, evmc::bytes32 const topics[],
+                           size_t num_topics) noexcept {
+  m_host.emit_log(addr, data, data_size, topics, num_topics);
+}
+
+} // namespace athena
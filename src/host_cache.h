@@ -0,0 +1,92 @@
+/*
+ * Copyright 2019-2020 Jesse Kuang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <evmc/evmc.h>
+#include <evmc/evmc.hpp>
+
+namespace athena {
+
+/// Answers to host queries that stay valid for the rest of a transaction.
+///
+/// It lives as long as the outermost frame athena executes on a thread, and is
+/// shared by the frames nested in it. That frame need not be at depth zero, as
+/// the client may execute the outer frames of a transaction itself, so the
+/// cache is not kept past it. Account facts are only kept once they can
+/// no longer change: an account that exists or has code keeps it until the
+/// transaction ends, unless a frame that created it fails, which is why a
+/// failed call drops them.
+struct HostCache {
+  std::optional<evmc_tx_context> txContext;
+  std::unordered_map<int64_t, evmc::bytes32> blockHashes;
+  std::unordered_set<evmc::address> existingAccounts;
+  std::unordered_map<evmc::address, size_t> codeSizes;
+  std::unordered_map<evmc::address, evmc::bytes32> codeHashes;
+
+  void clear() {
+    txContext.reset();
+    blockHashes.clear();
+    clearAccounts();
+  }
+
+  void clearAccounts() {
+    existingAccounts.clear();
+    codeSizes.clear();
+    codeHashes.clear();
+  }
+};
+
+/// Host of a single execution that answers repeated queries from @cache and
+/// forwards everything else to the client. Balances, storage and code
+/// contents change during a transaction and always go to the client.
+class CachingHost final : public evmc::HostInterface {
+public:
+  CachingHost(evmc_host_interface const &interface,
+              evmc_host_context *context, HostCache &cache) noexcept
+      : m_host(interface, context), m_cache(cache) {}
+
+  bool account_exists(evmc::address const &addr) noexcept final;
+  evmc::bytes32 get_storage(evmc::address const &addr,
+                            evmc::bytes32 const &key) noexcept final;
+  evmc_storage_status set_storage(evmc::address const &addr,
+                                  evmc::bytes32 const &key,
+                                  evmc::bytes32 const &value) noexcept final;
+  evmc::uint256be get_balance(evmc::address const &addr) noexcept final;
+  size_t get_code_size(evmc::address const &addr) noexcept final;
+  evmc::bytes32 get_code_hash(evmc::address const &addr) noexcept final;
+  size_t copy_code(evmc::address const &addr, size_t code_offset,
+                   uint8_t *buffer_data, size_t buffer_size) noexcept final;
+  void selfdestruct(evmc::address const &addr,
+                    evmc::address const &beneficiary) noexcept final;
+  evmc::result call(evmc_message const &msg) noexcept final;
+  evmc_tx_context get_tx_context() noexcept final;
+  evmc::bytes32 get_block_hash(int64_t block_number) noexcept final;
+  void emit_log(evmc::address const &addr, uint8_t const *data,
+                size_t data_size, evmc::bytes32 const topics[],
+                size_t num_topics) noexcept final;
+
+private:
+  evmc::HostContext m_host;
+  HostCache &m_cache;
+};
+
+} // namespace athena
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2019-2020 Jesse Kuang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "overlay_host.h"
+
+namespace athena {
+
+bool OverlayHost::account_exists(evmc::address const &addr) noexcept {
+  m_accounts.insert(addr);
+  return m_base.account_exists(addr);
+}
+
+evmc::bytes32 OverlayHost::get_storage(evmc::address const &addr,
+                                       evmc::bytes32 const &key) noexcept {
+  StorageKey slot{addr, key};
+  auto written = m_slots.find(slot);
+  if (written != m_slots.end())
+    return written->second.current;
+  m_reads.insert(slot);
+  return m_base.get_storage(addr, key);
+}
+
+evmc_storage_status
+OverlayHost::set_storage(evmc::address const &addr, evmc::bytes32 const &key,
+                         evmc::bytes32 const &value) noexcept {
+  StorageKey slot{addr, key};
+  auto written = m_slots.find(slot);
+  if (written == m_slots.end()) {
+    // The value before the store only decides the status, which the result
+    // does not depend on, so it is not recorded as a read.
+    const evmc::bytes32 original = m_base.get_storage(addr, key);
+    written = m_slots.emplace(slot, Slot{original, original}).first;
+  }
+  m_stores.push_back({slot, value});
+
+  Slot &current = written->second;
+  evmc_storage_status status;
+  if (current.current == value)
+    status = EVMC_STORAGE_UNCHANGED;
+  else if (current.original != current.current)
+    status = EVMC_STORAGE_MODIFIED_AGAIN;
+  else if (is_zero(current.original))
+    status = EVMC_STORAGE_ADDED;
+  else if (is_zero(value))
+    status = EVMC_STORAGE_DELETED;
+  else
+    status = EVMC_STORAGE_MODIFIED;
+  current.current = value;
+  return status;
+}
+
+evmc::uint256be OverlayHost::get_balance(evmc::address const &addr) noexcept {
+  m_accounts.insert(addr);
+  return m_base.get_balance(addr);
+}
+
+size_t OverlayHost::get_code_size(evmc::address const &addr) noexcept {
+  m_accounts.insert(addr);
+  return m_base.get_code_size(addr);
+}
+
+evmc::bytes32 OverlayHost::get_code_hash(evmc::address const &addr) noexcept {
+  m_accounts.insert(addr);
+  return m_base.get_code_hash(addr);
+}
+
+size_t OverlayHost::copy_code(evmc::address const &addr, size_t code_offset,
+                              uint8_t *buffer_data,
+                              size_t buffer_size) noexcept {
+  m_accounts.insert(addr);
+  return m_base.copy_code(addr, code_offset, buffer_data, buffer_size);
+}
+
+void OverlayHost::selfdestruct(evmc::address const &,
+                               evmc::address const &) noexcept {
+  m_escaped = true;
+}
+
+evmc::result OverlayHost::call(evmc_message const &) noexcept {
+  m_escaped = true;
+  evmc_result result{};
+  result.status_code = EVMC_REJECTED;
+  return evmc::result{result};
+}
+
+evmc_tx_context OverlayHost::get_tx_context() noexcept {
+  return m_base.get_tx_context();
+}
+
+evmc::bytes32 OverlayHost::get_block_hash(int64_t block_number) noexcept {
+  return m_base.get_block_hash(block_number);
+}
+
+void OverlayHost::emit_log(evmc::address const &addr, uint8_t const *data,
+                           size_t data_size, evmc::bytes32 const topics[],
+                           size_t num_topics) noexcept {
+  m_logs.push_back({addr, bytes(data, data_size),
+                    std::vector<evmc::bytes32>(topics, topics + num_topics)});
+}
+
+namespace {
+// Whether the sets share an element, probing the larger one.
+template <typename Set>
+bool intersects(Set const &a, Set const &b) noexcept {
+  if (a.size() > b.size())
+    return intersects(b, a);
+  for (auto const &item : a)
+    if (b.count(item))
+      return true;
+  return false;
+}
+} // namespace
+
+bool OverlayHost::readAny(StorageKeys const &written) const noexcept {
+  return intersects(m_reads, written);
+}
+
+bool OverlayHost::readAny(Accounts const &accounts) const noexcept {
+  return intersects(m_accounts, accounts);
+}
+
+void OverlayHost::commit(evmc::HostInterface &host,
+                         StorageKeys &written) const {
+  for (auto const &store : m_stores) {
+    host.set_storage(store.key.first, store.key.second, store.value);
+    written.insert(store.key);
+  }
+  for (auto const &log : m_logs)
+    host.emit_log(log.addr, log.data.data(), log.data.size(),
+                  log.topics.data(), log.topics.size());
+}
+
+} // namespace athena
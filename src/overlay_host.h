@@ -0,0 +1,122 @@
+/*
+ * Copyright 2019-2020 Jesse Kuang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <evmc/evmc.h>
+#include <evmc/evmc.hpp>
+
+#include "helpers.h"
+
+namespace athena {
+
+/// A storage slot of an account.
+using StorageKey = std::pair<evmc::address, evmc::bytes32>;
+
+struct StorageKeyHash {
+  size_t operator()(StorageKey const &key) const noexcept {
+    const size_t seed = std::hash<evmc::address>{}(key.first);
+    return seed ^ (std::hash<evmc::bytes32>{}(key.second) + 0x9e3779b9 +
+                   (seed << 6) + (seed >> 2));
+  }
+};
+
+using StorageKeys = std::unordered_set<StorageKey, StorageKeyHash>;
+
+using Accounts = std::unordered_set<evmc::address>;
+
+/// Host of a speculative execution, which reads the state of @base but keeps
+/// its own changes until they are committed.
+///
+/// It records what its result depends on: the storage slots the execution
+/// read before writing them, and the accounts whose existence, balance or
+/// code it read. It buffers its stores and logs. Calls, creates and
+/// selfdestructs need the client and are not forwarded at all: they only
+/// mark the execution as escaped, and its result is to be thrown away.
+class OverlayHost final : public evmc::HostInterface {
+public:
+  explicit OverlayHost(evmc::HostInterface &base) noexcept : m_base(base) {}
+
+  bool account_exists(evmc::address const &addr) noexcept final;
+  evmc::bytes32 get_storage(evmc::address const &addr,
+                            evmc::bytes32 const &key) noexcept final;
+  evmc_storage_status set_storage(evmc::address const &addr,
+                                  evmc::bytes32 const &key,
+                                  evmc::bytes32 const &value) noexcept final;
+  evmc::uint256be get_balance(evmc::address const &addr) noexcept final;
+  size_t get_code_size(evmc::address const &addr) noexcept final;
+  evmc::bytes32 get_code_hash(evmc::address const &addr) noexcept final;
+  size_t copy_code(evmc::address const &addr, size_t code_offset,
+                   uint8_t *buffer_data, size_t buffer_size) noexcept final;
+  void selfdestruct(evmc::address const &addr,
+                    evmc::address const &beneficiary) noexcept final;
+  evmc::result call(evmc_message const &msg) noexcept final;
+  evmc_tx_context get_tx_context() noexcept final;
+  evmc::bytes32 get_block_hash(int64_t block_number) noexcept final;
+  void emit_log(evmc::address const &addr, uint8_t const *data,
+                size_t data_size, evmc::bytes32 const topics[],
+                size_t num_topics) noexcept final;
+
+  /// Whether the execution needed the client for a call, a create or a
+  /// selfdestruct.
+  bool escaped() const noexcept { return m_escaped; }
+
+  /// Whether the execution read any of the slots in @written.
+  bool readAny(StorageKeys const &written) const noexcept;
+
+  /// Whether the execution read the existence, balance or code of any of
+  /// @accounts.
+  bool readAny(Accounts const &accounts) const noexcept;
+
+  /// Replays the buffered stores and logs on @host in the order the execution
+  /// made them, adding the stored slots to @written.
+  void commit(evmc::HostInterface &host, StorageKeys &written) const;
+
+private:
+  struct Store {
+    StorageKey key;
+    evmc::bytes32 value;
+  };
+
+  struct Log {
+    evmc::address addr;
+    bytes data;
+    std::vector<evmc::bytes32> topics;
+  };
+
+  struct Slot {
+    evmc::bytes32 original;
+    evmc::bytes32 current;
+  };
+
+  evmc::HostInterface &m_base;
+  bool m_escaped = false;
+  StorageKeys m_reads;
+  Accounts m_accounts;
+  // The slots written so far, with the value they had before.
+  std::unordered_map<StorageKey, Slot, StorageKeyHash> m_slots;
+  std::vector<Store> m_stores;
+  std::vector<Log> m_logs;
+};
+
+} // namespace athena
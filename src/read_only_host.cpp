@@ -0,0 +1,82 @@
+/*
+ * Copyright 2019-2020 Jesse Kuang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "read_only_host.h"
+
+namespace athena {
+
+bool ReadOnlyHost::account_exists(evmc::address const &addr) noexcept {
+  auto lock = query();
+  return m_host.account_exists(addr);
+}
+
+evmc::bytes32 ReadOnlyHost::get_storage(evmc::address const &addr,
+                                        evmc::bytes32 const &key) noexcept {
+  auto lock = query();
+  return m_host.get_storage(addr, key);
+}
+
+evmc_storage_status ReadOnlyHost::set_storage(evmc::address const &,
+                                              evmc::bytes32 const &,
+                                              evmc::bytes32 const &) noexcept {
+  return EVMC_STORAGE_UNCHANGED;
+}
+
+evmc::uint256be ReadOnlyHost::get_balance(evmc::address const &addr) noexcept {
+  auto lock = query();
+  return m_host.get_balance(addr);
+}
+
+size_t ReadOnlyHost::get_code_size(evmc::address const &addr) noexcept {
+  auto lock = query();
+  return m_host.get_code_size(addr);
+}
+
+evmc::bytes32 ReadOnlyHost::get_code_hash(evmc::address const &addr) noexcept {
+  auto lock = query();
+  return m_host.get_code_hash(addr);
+}
+
+size_t ReadOnlyHost::copy_code(evmc::address const &addr, size_t code_offset,
+                               uint8_t *buffer_data,
+                               size_t buffer_size) noexcept {
+  auto lock = query();
+  return m_host.copy_code(addr, code_offset, buffer_data, buffer_size);
+}
+
+void ReadOnlyHost::selfdestruct(evmc::address const &,
+                                evmc::address const &) noexcept {}
+
+evmc::result ReadOnlyHost::call(evmc_message const &msg) noexcept {
+  evmc_message message = msg;
+  message.flags |= EVMC_STATIC;
+  return m_host.call(message);
+}
+
+evmc_tx_context ReadOnlyHost::get_tx_context() noexcept {
+  auto lock = query();
+  return m_host.get_tx_context();
+}
+
+evmc::bytes32 ReadOnlyHost::get_block_hash(int64_t block_number) noexcept {
+  auto lock = query();
+  return m_host.get_block_hash(block_number);
+}
+
+void ReadOnlyHost::emit_log(evmc::address const &, uint8_t const *, size_t,
+                            evmc::bytes32 const[], size_t) noexcept {}
+
+} // namespace athena
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2019-2020 Jesse Kuang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+
+#include <evmc/evmc.h>
+#include <evmc/evmc.hpp>
+
+namespace athena {
+
+/// Host of static calls that execute on many threads at once against one
+/// client host, which only needs to answer a single query at a time.
+///
+/// Queries are forwarded to the client holding @lock, or without a lock if it
+/// is null and the client host is thread-safe. Static calls reject writes
+/// before they reach the host, so none are forwarded. Nested calls are
+/// forwarded without the lock, as the client executes them with another
+/// static call.
+class ReadOnlyHost final : public evmc::HostInterface {
+public:
+  ReadOnlyHost(evmc_host_interface const &interface,
+               evmc_host_context *context, std::mutex *lock) noexcept
+      : m_host(interface, context), m_lock(lock) {}
+
+  bool account_exists(evmc::address const &addr) noexcept final;
+  evmc::bytes32 get_storage(evmc::address const &addr,
+                            evmc::bytes32 const &key) noexcept final;
+  evmc_storage_status set_storage(evmc::address const &addr,
+                                  evmc::bytes32 const &key,
+                                  evmc::bytes32 const &value) noexcept final;
+  evmc::uint256be get_balance(evmc::address const &addr) noexcept final;
+  size_t get_code_size(evmc::address const &addr) noexcept final;
+  evmc::bytes32 get_code_hash(evmc::address const &addr) noexcept final;
+  size_t copy_code(evmc::address const &addr, size_t code_offset,
+                   uint8_t *buffer_data, size_t buffer_size) noexcept final;
+  void selfdestruct(evmc::address const &addr,
+                    evmc::address const &beneficiary) noexcept final;
+  evmc::result call(evmc_message const &msg) noexcept final;
+  evmc_tx_context get_tx_context() noexcept final;
+  evmc::bytes32 get_block_hash(int64_t block_number) noexcept final;
+  void emit_log(evmc::address const &addr, uint8_t const *data,
+                size_t data_size, evmc::bytes32 const topics[],
+                size_t num_topics) noexcept final;
+
+private:
+  // Holds the lock, if any, for the duration of one query.
+  std::unique_lock<std::mutex> query() const {
+    return m_lock ? std::unique_lock<std::mutex>(*m_lock)
+                  : std::unique_lock<std::mutex>();
+  }
+
+  evmc::HostContext m_host;
+  std::mutex *m_lock;
+};
+
+} // namespace athena
@@ -29,8 +29,10 @@
 #include "src/wast-lexer.h"
 #include "src/wast-parser.h"
 
+#include "cache.h"
 #include "debugging.h"
 #include "eei.h"
+#include "eei_impl.h"
 #include "exceptions.h"
 #include "wabt.h"
 
@@ -39,10 +41,20 @@ using namespace wabt;
 
 namespace athena {
 
-class WabtEthereumInterface : public EthereumInterface {
+// Linear memory of the environment being executed.
+struct WabtMemory {
+  interp::Environment *env = nullptr;
+
+  size_t size() const { return env->GetMemory(0)->data.size(); }
+  uint8_t *data() const {
+    return reinterpret_cast<uint8_t *>(env->GetMemory(0)->data.data());
+  }
+};
+
+class WabtEthereumInterface : public EthereumInterface<WabtMemory> {
 public:
   explicit WabtEthereumInterface(
-    evmc::HostContext& _context,
+    evmc::HostInterface& _context,
     bytes_view _code,
     evmc_message const& _msg,
     ExecutionResult & _result,
@@ -51,69 +63,44 @@ public:
     EthereumInterface(_context, _code, _msg, _result, _meterGas)
   {}
   void setEnv(interp::Environment *evP) {
-	envPtr = evP;
-  }
-
-private:
-  // These assume that m_wasmMemory was set prior to execution.
-  size_t memorySize() const override {
-	auto memPtr = envPtr->GetMemory(0);
-	return memPtr->data.size();
+	m_memory.env = evP;
   }
-  void memorySet(size_t offset, uint8_t value) override {
-	auto memPtr = envPtr->GetMemory(0);
-	memPtr->data[offset] = static_cast<char>(value);
-  }
-  uint8_t memoryGet(size_t offset) override {
-	auto memPtr = envPtr->GetMemory(0);
-	return static_cast<uint8_t>(memPtr->data[offset]);
-  }
-  uint8_t* memoryPointer(size_t offset, size_t length) override {
-	auto memPtr = envPtr->GetMemory(0);
-    ensureCondition(memorySize() >= (offset + length), InvalidMemoryAccess, "Memory is shorter than requested segment");
-    return reinterpret_cast<uint8_t*>(& memPtr->data[offset]);
-  }
-
-  interp::Environment *envPtr;
 };
 
-unique_ptr<WasmEngine> WabtEngine::create() {
-  return unique_ptr<WasmEngine>{new WabtEngine};
-}
-
-ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
-                                    bytes_view state_code,
-                                    evmc_message const &msg,
-                                    bool meterInterfaceGas) {
-  instantiationStarted();
-#if H_DEBUGGING
-  H_DEBUG << "Executing with wabt...\n";
-#endif
+// A contract decoded into an environment of its own, linked against the host
+// modules. Host functions call into whichever interface is bound for the
+// current execution, so the whole environment can be kept between calls.
+struct WabtInstance {
+  interp::Environment env{Features{}};
+  interp::DefinedModule *module = nullptr;
+  WabtEthereumInterface *interface = nullptr;
+  // Memory size and global values to restore before each execution.
+  Limits pageLimits;
+  vector<interp::TypedValue> globals;
+};
 
-  // Set up the wabt Environment, which includes the Wasm store
-  // and the list of modules used for importing/exporting between modules
-  interp::Environment env(Features{});
+struct WabtEngine::ModuleCache : CodeCache<unique_ptr<WabtInstance>> {
+  using CodeCache::CodeCache;
+};
 
-  // Set up interface to eei host functions
-  ExecutionResult result;
-  WabtEthereumInterface interface{context, state_code, msg, result,
-                                  meterInterfaceGas};
+namespace {
 
+void linkHostModules(WabtInstance &instance) {
   // Create EEI host module
   // The lifecycle of this pointer is handled by `env`.
-  interp::HostModule *hostModule = env.AppendHostModule("ethereum");
+  interp::HostModule *hostModule = instance.env.AppendHostModule("ethereum");
   athenaAssert(hostModule, "Failed to create host module.");
 
   hostModule->AppendFuncExport(
     "useGas",
     {{Type::I64}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.eeiUseGas(static_cast<int64_t>(args[0].value.i64));
+      instance.interface->eeiUseGas(static_cast<int64_t>(args[0].value.i64));
       return interp::ResultType::Ok;
     }
   );
@@ -121,13 +108,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "getAddress",
     {{Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.eeiGetAddress(args[0].value.i32);
+      instance.interface->eeiGetAddress(args[0].value.i32);
       return interp::ResultType::Ok;
     }
   );
@@ -135,13 +122,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "getExternalBalance",
     {{Type::I32, Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.eeiGetExternalBalance(args[0].value.i32, args[1].value.i32);
+      instance.interface->eeiGetExternalBalance(args[0].value.i32, args[1].value.i32);
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -149,13 +136,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "getBlockHash",
     {{Type::I64, Type::I32}, {Type::I32}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues& results
     ) {
-      results[0].set_i32(interface.eeiGetBlockHash(args[0].value.i64, args[1].value.i32));
+      results[0].set_i32(instance.interface->eeiGetBlockHash(args[0].value.i64, args[1].value.i32));
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -163,14 +150,14 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "call",
     {{Type::I64, Type::I32, Type::I32, Type::I32, Type::I32}, {Type::I32}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues& results
     ) {
-      results[0].set_i32(interface.eeiCall(
-        EthereumInterface::EEICallKind::Call,
+      results[0].set_i32(instance.interface->eeiCall(
+        WabtEthereumInterface::EEICallKind::Call,
         static_cast<int64_t>(args[0].value.i64), args[1].value.i32,
         args[2].value.i32, args[3].value.i32, args[4].value.i32
       ));
@@ -181,13 +168,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "callDataCopy",
     {{Type::I32, Type::I32, Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.eeiCallDataCopy(args[0].value.i32, args[1].value.i32, args[2].value.i32);
+      instance.interface->eeiCallDataCopy(args[0].value.i32, args[1].value.i32, args[2].value.i32);
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -195,13 +182,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "getCallDataSize",
     {{}, {Type::I32}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues&,
       interp::TypedValues& results
     ) {
-      results[0].set_i32(interface.eeiGetCallDataSize());
+      results[0].set_i32(instance.interface->eeiGetCallDataSize());
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -209,14 +196,14 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "callCode",
     {{Type::I64, Type::I32, Type::I32, Type::I32, Type::I32}, {Type::I32}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues& results
     ) {
-      results[0].set_i32(interface.eeiCall(
-        EthereumInterface::EEICallKind::CallCode,
+      results[0].set_i32(instance.interface->eeiCall(
+        WabtEthereumInterface::EEICallKind::CallCode,
         static_cast<int64_t>(args[0].value.i64), args[1].value.i32,
         args[2].value.i32, args[3].value.i32, args[4].value.i32
       ));
@@ -227,14 +214,14 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "callDelegate",
     {{Type::I64, Type::I32, Type::I32, Type::I32}, {Type::I32}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues& results
     ) {
-      results[0].set_i32(interface.eeiCall(
-        EthereumInterface::EEICallKind::CallDelegate,
+      results[0].set_i32(instance.interface->eeiCall(
+        WabtEthereumInterface::EEICallKind::CallDelegate,
         static_cast<int64_t>(args[0].value.i64), args[1].value.i32, 0,
         args[2].value.i32, args[3].value.i32
       ));
@@ -245,14 +232,14 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "callStatic",
     {{Type::I64, Type::I32, Type::I32, Type::I32}, {Type::I32}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues& results
     ) {
-      results[0].set_i32(interface.eeiCall(
-        EthereumInterface::EEICallKind::CallStatic,
+      results[0].set_i32(instance.interface->eeiCall(
+        WabtEthereumInterface::EEICallKind::CallStatic,
         static_cast<int64_t>(args[0].value.i64), args[1].value.i32, 0,
         args[2].value.i32, args[3].value.i32
       ));
@@ -263,13 +250,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "storageStore",
     {{Type::I32, Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.eeiStorageStore(args[0].value.i32, args[1].value.i32);
+      instance.interface->eeiStorageStore(args[0].value.i32, args[1].value.i32);
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -277,13 +264,43 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "storageLoad",
     {{Type::I32, Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.eeiStorageLoad(args[0].value.i32, args[1].value.i32);
+      instance.interface->eeiStorageLoad(args[0].value.i32, args[1].value.i32);
+      return interp::Result(interp::ResultType::Ok);
+    }
+  );
+
+  hostModule->AppendFuncExport(
+    "storageStoreMulti",
+    {{Type::I32, Type::I32, Type::I32}, {}},
+    [&instance](
+      const interp::HostFunc*,
+      const interp::FuncSignature*,
+      const interp::TypedValues& args,
+      interp::TypedValues&
+    ) {
+      instance.interface->eeiStorageStoreMulti(
+        args[0].value.i32, args[1].value.i32, args[2].value.i32);
+      return interp::Result(interp::ResultType::Ok);
+    }
+  );
+
+  hostModule->AppendFuncExport(
+    "storageLoadMulti",
+    {{Type::I32, Type::I32, Type::I32}, {}},
+    [&instance](
+      const interp::HostFunc*,
+      const interp::FuncSignature*,
+      const interp::TypedValues& args,
+      interp::TypedValues&
+    ) {
+      instance.interface->eeiStorageLoadMulti(
+        args[0].value.i32, args[1].value.i32, args[2].value.i32);
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -291,13 +308,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "getCaller",
     {{Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.eeiGetCaller(args[0].value.i32);
+      instance.interface->eeiGetCaller(args[0].value.i32);
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -305,13 +322,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "getCallValue",
     {{Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.eeiGetCallValue(args[0].value.i32);
+      instance.interface->eeiGetCallValue(args[0].value.i32);
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -319,13 +336,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "codeCopy",
     {{Type::I32, Type::I32, Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.eeiCodeCopy(args[0].value.i32, args[1].value.i32, args[2].value.i32);
+      instance.interface->eeiCodeCopy(args[0].value.i32, args[1].value.i32, args[2].value.i32);
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -333,13 +350,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "getCodeSize",
     {{}, {Type::I32}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues&,
       interp::TypedValues& results
     ) {
-      results[0].set_i32(interface.eeiGetCodeSize());
+      results[0].set_i32(instance.interface->eeiGetCodeSize());
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -347,13 +364,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "getBlockCoinbase",
     {{Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.eeiGetBlockCoinbase(args[0].value.i32);
+      instance.interface->eeiGetBlockCoinbase(args[0].value.i32);
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -361,13 +378,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "create",
     {{Type::I32, Type::I32, Type::I32, Type::I32}, {Type::I32}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues& results
     ) {
-      results[0].set_i32(interface.eeiCreate(
+      results[0].set_i32(instance.interface->eeiCreate(
         args[0].value.i32, args[1].value.i32,
         args[2].value.i32, args[3].value.i32
       ));
@@ -378,13 +395,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "getBlockDifficulty",
     {{Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.eeiGetBlockDifficulty(args[0].value.i32);
+      instance.interface->eeiGetBlockDifficulty(args[0].value.i32);
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -392,13 +409,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "externalCodeCopy",
     {{Type::I32, Type::I32, Type::I32, Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.eeiExternalCodeCopy(
+      instance.interface->eeiExternalCodeCopy(
         args[0].value.i32, args[1].value.i32,
         args[2].value.i32, args[3].value.i32
       );
@@ -409,13 +426,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "getExternalCodeSize",
     {{Type::I32}, {Type::I32}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues& results
     ) {
-      results[0].set_i32(interface.eeiGetExternalCodeSize(args[0].value.i32));
+      results[0].set_i32(instance.interface->eeiGetExternalCodeSize(args[0].value.i32));
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -423,13 +440,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "getGasLeft",
     {{}, {Type::I64}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues&,
       interp::TypedValues& results
     ) {
-      results[0].set_i64(static_cast<uint64_t>(interface.eeiGetGasLeft()));
+      results[0].set_i64(static_cast<uint64_t>(instance.interface->eeiGetGasLeft()));
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -437,13 +454,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "getBlockGasLimit",
     {{}, {Type::I64}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues&,
       interp::TypedValues& results
     ) {
-      results[0].set_i64(static_cast<uint64_t>(interface.eeiGetBlockGasLimit()));
+      results[0].set_i64(static_cast<uint64_t>(instance.interface->eeiGetBlockGasLimit()));
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -451,13 +468,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "getTxGasPrice",
     {{Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.eeiGetTxGasPrice(args[0].value.i32);
+      instance.interface->eeiGetTxGasPrice(args[0].value.i32);
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -465,13 +482,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "log",
     {{Type::I32, Type::I32, Type::I32, Type::I32, Type::I32, Type::I32, Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.eeiLog(
+      instance.interface->eeiLog(
         args[0].value.i32, args[1].value.i32, args[2].value.i32, args[3].value.i32,
         args[4].value.i32, args[5].value.i32, args[6].value.i32
       );
@@ -482,13 +499,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "getBlockNumber",
     {{}, {Type::I64}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues&,
       interp::TypedValues& results
     ) {
-      results[0].set_i64(static_cast<uint64_t>(interface.eeiGetBlockNumber()));
+      results[0].set_i64(static_cast<uint64_t>(instance.interface->eeiGetBlockNumber()));
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -496,13 +513,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "getTxOrigin",
     {{Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.eeiGetTxOrigin(args[0].value.i32);
+      instance.interface->eeiGetTxOrigin(args[0].value.i32);
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -510,16 +527,16 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "finish",
     {{Type::I32, Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
 #if H_DEBUGGING
-      interface.debugPrintMem(true, args[0].value.i32, args[1].value.i32);
+      instance.interface->debugPrintMem(true, args[0].value.i32, args[1].value.i32);
 #endif
-      interface.eeiFinish(args[0].value.i32, args[1].value.i32);
+      instance.interface->eeiFinish(args[0].value.i32, args[1].value.i32);
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -527,13 +544,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "revert",
     {{Type::I32, Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.eeiRevert(args[0].value.i32, args[1].value.i32);
+      instance.interface->eeiRevert(args[0].value.i32, args[1].value.i32);
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -541,13 +558,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "getReturnDataSize",
     {{}, {Type::I32}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues&,
       interp::TypedValues& results
     ) {
-      results[0].set_i32(interface.eeiGetReturnDataSize());
+      results[0].set_i32(instance.interface->eeiGetReturnDataSize());
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -555,13 +572,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "returnDataCopy",
     {{Type::I32, Type::I32, Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.eeiReturnDataCopy(args[0].value.i32, args[1].value.i32, args[2].value.i32);
+      instance.interface->eeiReturnDataCopy(args[0].value.i32, args[1].value.i32, args[2].value.i32);
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -569,13 +586,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "selfDestruct",
     {{Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.eeiSelfDestruct(args[0].value.i32);
+      instance.interface->eeiSelfDestruct(args[0].value.i32);
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -583,13 +600,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "getBlockTimestamp",
     {{}, {Type::I64}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues&,
       interp::TypedValues& results
     ) {
-      results[0].set_i64(static_cast<uint64_t>(interface.eeiGetBlockTimestamp()));
+      results[0].set_i64(static_cast<uint64_t>(instance.interface->eeiGetBlockTimestamp()));
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -597,19 +614,19 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
 #if H_DEBUGGING
   // Create debug host module
   // The lifecycle of this pointer is handled by `env`.
-  hostModule = env.AppendHostModule("debug");
+  hostModule = instance.env.AppendHostModule("debug");
   athenaAssert(hostModule, "Failed to create host module.");
 
   hostModule->AppendFuncExport(
     "print",
     {{Type::I32, Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.debugPrint(args[0].value.i32, args[1].value.i32);
+      instance.interface->debugPrint(args[0].value.i32, args[1].value.i32);
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -617,13 +634,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "print32",
     {{Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.debugPrint32(args[0].value.i32);
+      instance.interface->debugPrint32(args[0].value.i32);
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -631,13 +648,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "print64",
     {{Type::I64}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.debugPrint64(args[0].value.i64);
+      instance.interface->debugPrint64(args[0].value.i64);
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -645,13 +662,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "printMem",
     {{Type::I32, Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.debugPrintMem(false, args[0].value.i32, args[1].value.i32);
+      instance.interface->debugPrintMem(false, args[0].value.i32, args[1].value.i32);
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -659,13 +676,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "printMemHex",
     {{Type::I32, Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.debugPrintMem(true, args[0].value.i32, args[1].value.i32);
+      instance.interface->debugPrintMem(true, args[0].value.i32, args[1].value.i32);
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -673,13 +690,13 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "printStorage",
     {{Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.debugPrintStorage(false, args[0].value.i32);
+      instance.interface->debugPrintStorage(false, args[0].value.i32);
       return interp::Result(interp::ResultType::Ok);
     }
   );
@@ -687,17 +704,22 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   hostModule->AppendFuncExport(
     "printStorageHex",
     {{Type::I32}, {}},
-    [&interface](
+    [&instance](
       const interp::HostFunc*,
       const interp::FuncSignature*,
       const interp::TypedValues& args,
       interp::TypedValues&
     ) {
-      interface.debugPrintStorage(true, args[0].value.i32);
+      instance.interface->debugPrintStorage(true, args[0].value.i32);
       return interp::Result(interp::ResultType::Ok);
     }
   );
 #endif
+}
+
+unique_ptr<WabtInstance> instantiate(bytes_view code) {
+  auto instance = make_unique<WabtInstance>();
+  linkHostModules(*instance);
 
   // Parse module
   ReadBinaryOptions options(Features{},
@@ -708,9 +730,8 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   );
 
   Errors errors;
-  interp::DefinedModule *module = nullptr;
-  Result loadResult = ReadBinaryInterp(&env, code.data(), code.size(), options,
-                                       &errors, &module);
+  Result loadResult = ReadBinaryInterp(&instance->env, code.data(), code.size(),
+                                       options, &errors, &instance->module);
 
 #if H_DEBUGGING
   for (auto it = errors.begin(); it != errors.end(); ++it) {
@@ -718,18 +739,102 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
   }
 #endif
 
-  ensureCondition(Succeeded(loadResult) && module, ContractValidationFailure,
-                  "Module failed to load.");
-  ensureCondition(env.GetMemoryCount() == 1, ContractValidationFailure,
+  ensureCondition(Succeeded(loadResult) && instance->module,
+                  ContractValidationFailure, "Module failed to load.");
+  ensureCondition(instance->env.GetMemoryCount() == 1,
+                  ContractValidationFailure,
                   "Multiple memory sections exported.");
-  ensureCondition(module->GetExport("memory"), ContractValidationFailure,
-                  "\"memory\" not found");
-  ensureCondition(module->start_func_index == kInvalidIndex,
+  ensureCondition(instance->module->GetExport("memory"),
+                  ContractValidationFailure, "\"memory\" not found");
+  ensureCondition(instance->module->start_func_index == kInvalidIndex,
                   ContractValidationFailure,
                   "Contract contains start function.");
 
+  interp::Memory *memory = instance->env.GetMemory(0);
+  instance->pageLimits = memory->page_limits;
+  for (Index i = 0; i < instance->env.GetGlobalCount(); i++)
+    instance->globals.push_back(instance->env.GetGlobal(i)->typed_value);
+
+  return instance;
+}
+
+// Restores memory and globals to what the module declares. Data and element
+// segments are copied in again by Executor::Initialize().
+void reset(WabtInstance &instance) {
+  interp::Memory *memory = instance.env.GetMemory(0);
+  memory->page_limits = instance.pageLimits;
+  memory->data.assign(instance.pageLimits.initial * WABT_PAGE_SIZE, 0);
+  for (Index i = 0; i < instance.globals.size(); i++)
+    instance.env.GetGlobal(i)->typed_value = instance.globals[i];
+}
+
+// Memory held by an instance: its instruction stream and linear memory.
+size_t instanceFootprint(WabtInstance &instance) {
+  return instance.env.istream().data.size() +
+         instance.env.GetMemory(0)->data.capacity();
+}
+
+} // namespace
+
+WabtEngine::WabtEngine() : m_modules(make_unique<ModuleCache>()) {}
+
+WabtEngine::~WabtEngine() noexcept = default;
+
+unique_ptr<WasmEngine> WabtEngine::create() {
+  return unique_ptr<WasmEngine>{new WabtEngine};
+}
+
+void WabtEngine::setModuleCacheBudget(size_t budget) {
+  m_modules->setBudget(budget);
+}
+
+ExecutionResult WabtEngine::execute(evmc::HostInterface &context,
+                                    bytes_view code, bytes_view state_code,
+                                    evmc_message const &msg,
+                                    bool meterInterfaceGas,
+                                    bool meterInstructions) {
+  athenaAssert(!meterInstructions, "wabt does not meter instructions.");
+  instantiationStarted();
+#if H_DEBUGGING
+  H_DEBUG << "Executing with wabt...\n";
+#endif
+
+  // Reuse the decoded module if this code ran before. It is checked out for
+  // the duration of the call, so a reentrant call into the same code decodes
+  // its own copy.
+  ModuleCache::Item compiled;
+  if (auto cached = m_modules->take(code)) {
+#if H_DEBUGGING
+    H_DEBUG << "Using cached wabt module (" << cached->code.size()
+            << " bytes)\n";
+#endif
+    compiled = move(*cached);
+    reset(*compiled.value);
+  } else {
+    compiled.value = instantiate(code);
+    compiled.code = bytes{code};
+  }
+  // Hand the module back to the cache however the execution ends.
+  struct CheckIn {
+    ModuleCache &cache;
+    ModuleCache::Item &item;
+    ~CheckIn() {
+      item.value->interface = nullptr;
+      item.cost = instanceFootprint(*item.value);
+      cache.put(move(item));
+    }
+  } checkin{*m_modules, compiled};
+  WabtInstance &instance = *compiled.value;
+  interp::Environment &env = instance.env;
+
+  // Set up interface to eei host functions
+  ExecutionResult result;
+  WabtEthereumInterface interface{context, state_code, msg, result,
+                                  meterInterfaceGas};
+  instance.interface = &interface;
+
   // Prepare to execute
-  interp::Export *mainFunction = module->GetExport("main");
+  interp::Export *mainFunction = instance.module->GetExport("main");
   ensureCondition(mainFunction, ContractValidationFailure,
                   "\"main\" not found");
   ensureCondition(mainFunction->kind == ExternalKind::Func,
@@ -746,7 +851,7 @@ ExecutionResult WabtEngine::execute(evmc::HostContext &context, bytes_view code,
 
   // Execute main
   try {
-    interp::ExecResult wabtResult = executor.Initialize(module);
+    interp::ExecResult wabtResult = executor.Initialize(instance.module);
     ensureCondition(wabtResult.result.ok(), VMTrap, "VM initialize failed.");
     wabtResult = executor.RunExport(
         mainFunction,
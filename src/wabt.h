@@ -22,12 +22,23 @@ namespace athena {
 
 class WabtEngine : public WasmEngine {
 public:
+  WabtEngine();
+  ~WabtEngine() noexcept override;
+
   /// Factory method to create the WABT Wasm Engine.
   static std::unique_ptr<WasmEngine> create();
 
-  ExecutionResult execute(evmc::HostContext &context, bytes_view code,
+  ExecutionResult execute(evmc::HostInterface &context, bytes_view code,
                           bytes_view state_code, evmc_message const &msg,
-                          bool meterInterfaceGas) override;
+                          bool meterInterfaceGas,
+                          bool meterInstructions) override;
+
+  void setModuleCacheBudget(size_t budget) override;
+
+private:
+  // Decoded modules by code, defined next to the instance type.
+  struct ModuleCache;
+  std::unique_ptr<ModuleCache> m_modules;
 };
 
 } // namespace athena
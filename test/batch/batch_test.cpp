@@ -0,0 +1,516 @@
+/*
+ * Copyright 2019-2020 Jesse Kuang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Executes blocks of messages with athena_execute_batch against an in-memory
+// state, and checks that the results and the final state match executing the
+// same messages one after another with execute().
+
+#include <athena/athena.h>
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <evmc/evmc.hpp>
+
+using namespace std;
+using namespace evmc::literals;
+
+namespace {
+
+using bytes = basic_string<uint8_t>;
+
+int failures = 0;
+
+#define EXPECT(condition)                                                      \
+  do {                                                                         \
+    if (!(condition)) {                                                        \
+      cerr << __FILE__ << ":" << __LINE__ << ": expected " #condition "\n";    \
+      failures++;                                                              \
+    }                                                                          \
+  } while (false)
+
+// Assembles a contract whose main function makes a straight sequence of EEI
+// calls. Imports are declared in the order they are first called.
+class Contract {
+public:
+  Contract &i32(int32_t value) {
+    m_body.push_back(0x41);
+    signedLeb(m_body, value);
+    return *this;
+  }
+
+  Contract &i64(int64_t value) {
+    m_body.push_back(0x42);
+    signedLeb(m_body, value);
+    return *this;
+  }
+
+  // Adds one to the 64-bit word at @offset.
+  Contract &increment(int32_t offset) {
+    i32(offset).i32(offset);
+    m_body.insert(m_body.end(), {0x29, 0x03, 0x00}); // i64.load
+    i64(1);
+    m_body.push_back(0x7c);                          // i64.add
+    m_body.insert(m_body.end(), {0x37, 0x03, 0x00}); // i64.store
+    return *this;
+  }
+
+  Contract &call(string const &name) {
+    size_t index = 0;
+    while (index < m_imports.size() && m_imports[index] != name)
+      index++;
+    if (index == m_imports.size())
+      m_imports.push_back(name);
+    m_body.push_back(0x10);
+    unsignedLeb(m_body, index);
+    if (signature(name) == 4)
+      m_body.push_back(0x1a); // drop
+    return *this;
+  }
+
+  bytes code() const {
+    bytes module{0x00, 'a', 's', 'm', 0x01, 0x00, 0x00, 0x00};
+
+    const uint8_t typeI32 = 0x7f, typeI64 = 0x7e;
+    section(module, 1,
+            {5,
+             // 0: () -> ()
+             0x60, 0, 0,
+             // 1: (i32, i32) -> ()
+             0x60, 2, typeI32, typeI32, 0,
+             // 2: (i32, i32, i32) -> ()
+             0x60, 3, typeI32, typeI32, typeI32, 0,
+             // 3: (i32) -> ()
+             0x60, 1, typeI32, 0,
+             // 4: (i64, i32, i32, i32, i32) -> (i32)
+             0x60, 5, typeI64, typeI32, typeI32, typeI32, typeI32, 1, typeI32});
+
+    bytes imports;
+    unsignedLeb(imports, m_imports.size());
+    for (auto const &name : m_imports) {
+      appendName(imports, "ethereum");
+      appendName(imports, name);
+      imports.push_back(0x00);
+      imports.push_back(signature(name));
+    }
+    section(module, 2, imports);
+
+    section(module, 3, {1, 0});
+    section(module, 5, {1, 0x00, 1});
+
+    bytes exports{2};
+    appendName(exports, "main");
+    exports.push_back(0x00);
+    unsignedLeb(exports, m_imports.size());
+    appendName(exports, "memory");
+    exports.insert(exports.end(), {0x02, 0x00});
+    section(module, 7, exports);
+
+    bytes body{0};
+    body.append(m_body);
+    body.push_back(0x0b);
+    bytes functions{1};
+    unsignedLeb(functions, body.size());
+    functions.append(body);
+    section(module, 10, functions);
+    return module;
+  }
+
+private:
+  static uint8_t signature(string const &name) {
+    static const map<string, uint8_t> signatures{
+        {"storageLoad", 1},        {"storageStore", 1},
+        {"finish", 1},             {"revert", 1},
+        {"getExternalBalance", 1}, {"callDataCopy", 2},
+        {"getTxOrigin", 3},        {"getBlockCoinbase", 3},
+        {"selfDestruct", 3},       {"call", 4},
+    };
+    return signatures.at(name);
+  }
+
+  static void unsignedLeb(bytes &out, uint64_t value) {
+    do {
+      uint8_t byte = value & 0x7f;
+      value >>= 7;
+      out.push_back(value ? byte | 0x80 : byte);
+    } while (value);
+  }
+
+  static void signedLeb(bytes &out, int64_t value) {
+    for (;;) {
+      uint8_t byte = value & 0x7f;
+      value >>= 7;
+      if ((value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40))) {
+        out.push_back(byte);
+        return;
+      }
+      out.push_back(byte | 0x80);
+    }
+  }
+
+  static void appendName(bytes &out, string const &name) {
+    unsignedLeb(out, name.size());
+    out.append(name.begin(), name.end());
+  }
+
+  static void section(bytes &module, uint8_t id, bytes const &contents) {
+    module.push_back(id);
+    unsignedLeb(module, contents.size());
+    module.append(contents);
+  }
+
+  vector<string> m_imports;
+  bytes m_body;
+};
+
+// The messages below take two keys as input: memory 0..32 holds the first,
+// 32..64 the second, and 64..96 is scratch space for a value.
+
+// Stores the value of the first key plus one under the second key, and
+// returns it.
+const bytes increment = Contract{}
+                            .i32(0).i32(0).i32(64).call("callDataCopy")
+                            .i32(0).i32(64).call("storageLoad")
+                            .increment(64)
+                            .i32(32).i32(64).call("storageStore")
+                            .i32(64).i32(32).call("finish")
+                            .code();
+
+// Does the same, but reverts instead of returning.
+const bytes failedIncrement = Contract{}
+                                  .i32(0).i32(0).i32(64).call("callDataCopy")
+                                  .i32(0).i32(64).call("storageLoad")
+                                  .increment(64)
+                                  .i32(32).i32(64).call("storageStore")
+                                  .i32(64).i32(32).call("revert")
+                                  .code();
+
+// Stores the origin of the transaction under the first key, and returns it.
+const bytes storeOrigin = Contract{}
+                              .i32(0).i32(0).i32(32).call("callDataCopy")
+                              .i32(64 + 12).call("getTxOrigin")
+                              .i32(0).i32(64).call("storageStore")
+                              .i32(64).i32(32).call("finish")
+                              .code();
+
+// Stores the balance of the coinbase under the first key.
+const bytes storeCoinbaseBalance =
+    Contract{}
+        .i32(0).i32(0).i32(32).call("callDataCopy")
+        .i32(32 + 12).call("getBlockCoinbase")
+        .i32(32 + 12).i32(64).call("getExternalBalance")
+        .i32(0).i32(64).call("storageStore")
+        .code();
+
+// Stores one under the first key, then calls the account at memory 0.
+const bytes storeAndCall = Contract{}
+                               .i32(0).i32(0).i32(32).call("callDataCopy")
+                               .increment(64)
+                               .i32(0).i32(64).call("storageStore")
+                               .i64(100000).i32(0).i32(96).i32(0).i32(0)
+                               .call("call")
+                               .code();
+
+// Stores one under the first key, then selfdestructs.
+const bytes storeAndDestruct = Contract{}
+                                   .i32(0).i32(0).i32(32).call("callDataCopy")
+                                   .increment(64)
+                                   .i32(0).i32(64).call("storageStore")
+                                   .i32(32).call("selfDestruct")
+                                   .code();
+
+using Storage = map<evmc::address, map<evmc::bytes32, evmc::bytes32>>;
+
+// The state of the accounts, which only changes between executions.
+struct State {
+  Storage storage;
+  map<evmc::address, evmc::uint256be> balances;
+};
+
+// Host of the transaction of one message against @state.
+class TransactionHost : public evmc::Host {
+public:
+  TransactionHost(State &state, evmc_tx_context const &tx)
+      : m_state(state), m_tx(tx) {}
+
+  bool account_exists(evmc::address const &addr) noexcept final {
+    return m_state.balances.count(addr) || m_state.storage.count(addr);
+  }
+
+  evmc::bytes32 get_storage(evmc::address const &addr,
+                            evmc::bytes32 const &key) noexcept final {
+    auto account = m_state.storage.find(addr);
+    if (account == m_state.storage.end())
+      return {};
+    auto slot = account->second.find(key);
+    return slot == account->second.end() ? evmc::bytes32{} : slot->second;
+  }
+
+  evmc_storage_status set_storage(evmc::address const &addr,
+                                  evmc::bytes32 const &key,
+                                  evmc::bytes32 const &value) noexcept final {
+    evmc::bytes32 &slot = m_state.storage[addr][key];
+    const evmc_storage_status status =
+        slot == value ? EVMC_STORAGE_UNCHANGED : EVMC_STORAGE_MODIFIED;
+    slot = value;
+    return status;
+  }
+
+  evmc::uint256be get_balance(evmc::address const &addr) noexcept final {
+    auto balance = m_state.balances.find(addr);
+    return balance == m_state.balances.end() ? evmc::uint256be{}
+                                             : balance->second;
+  }
+
+  size_t get_code_size(evmc::address const &) noexcept final { return 0; }
+
+  evmc::bytes32 get_code_hash(evmc::address const &) noexcept final {
+    return {};
+  }
+
+  size_t copy_code(evmc::address const &, size_t, uint8_t *,
+                   size_t) noexcept final {
+    return 0;
+  }
+
+  void selfdestruct(evmc::address const &,
+                    evmc::address const &) noexcept final {}
+
+  evmc::result call(evmc_message const &msg) noexcept final {
+    return evmc::result{EVMC_SUCCESS, msg.gas, nullptr, 0};
+  }
+
+  evmc_tx_context get_tx_context() noexcept final { return m_tx; }
+
+  evmc::bytes32 get_block_hash(int64_t) noexcept final { return {}; }
+
+  void emit_log(evmc::address const &, uint8_t const *, size_t,
+                evmc::bytes32 const[], size_t) noexcept final {}
+
+private:
+  State &m_state;
+  evmc_tx_context m_tx;
+};
+
+const auto contract = 0x00000000000000000000000000000000000000c0_address;
+const auto coinbase = 0x00000000000000000000000000000000000000cb_address;
+
+evmc::address sender(uint8_t id) {
+  evmc::address address;
+  address.bytes[19] = id;
+  address.bytes[0] = 0x5e;
+  return address;
+}
+
+evmc::bytes32 key(uint8_t id) {
+  evmc::bytes32 key;
+  key.bytes[31] = id;
+  return key;
+}
+
+// A transaction from @from that executes @code with two keys as input.
+struct Transaction {
+  bytes code;
+  uint8_t from;
+  uint8_t first;
+  uint8_t second;
+};
+
+struct Outcome {
+  evmc_status_code status;
+  int64_t gasLeft;
+  bytes output;
+};
+
+Outcome outcome(evmc_result &result) {
+  Outcome ret{result.status_code, result.gas_left,
+              bytes(result.output_data, result.output_size)};
+  if (result.release)
+    result.release(&result);
+  return ret;
+}
+
+// The messages and hosts of @transactions on @state.
+struct Block {
+  vector<bytes> inputs;
+  vector<evmc_message> messages;
+  vector<unique_ptr<TransactionHost>> hosts;
+
+  Block(State &state, vector<Transaction> const &transactions) {
+    for (auto const &tx : transactions) {
+      bytes input;
+      input.append(key(tx.first).bytes, sizeof(evmc::bytes32));
+      input.append(key(tx.second).bytes, sizeof(evmc::bytes32));
+      inputs.push_back(input);
+
+      evmc_tx_context context{};
+      context.tx_origin = sender(tx.from);
+      context.tx_gas_price.bytes[31] = tx.from;
+      context.block_coinbase = coinbase;
+      hosts.push_back(make_unique<TransactionHost>(state, context));
+    }
+    for (size_t i = 0; i < transactions.size(); i++) {
+      evmc_message msg{};
+      msg.kind = EVMC_CALL;
+      msg.gas = 1000000;
+      msg.destination = contract;
+      msg.sender = sender(transactions[i].from);
+      msg.input_data = inputs[i].data();
+      msg.input_size = inputs[i].size();
+      messages.push_back(msg);
+    }
+  }
+};
+
+class Athena {
+public:
+  Athena() : m_instance{evmc_create_athena()} {
+    m_instance->set_option(m_instance, "batch:threads", "4");
+  }
+
+  ~Athena() noexcept { m_instance->destroy(m_instance); }
+
+  // Executes @transactions one after another, undoing the changes of those
+  // that fail like a client does.
+  vector<Outcome> serial(State &state,
+                         vector<Transaction> const &transactions) {
+    Block block{state, transactions};
+    vector<Outcome> ret;
+    for (size_t i = 0; i < transactions.size(); i++)
+      ret.push_back(execute(state, block, transactions, i));
+    return ret;
+  }
+
+  // Executes @transactions in batches, and the ones a batch stops at one
+  // after another. Returns the positions of the latter in @stops.
+  vector<Outcome> batched(State &state,
+                          vector<Transaction> const &transactions,
+                          vector<size_t> &stops) {
+    Block block{state, transactions};
+    vector<athena_batch_message> messages;
+    for (size_t i = 0; i < transactions.size(); i++)
+      messages.push_back({&block.messages[i], transactions[i].code.data(),
+                          transactions[i].code.size(),
+                          block.hosts[i]->to_context()});
+
+    vector<Outcome> ret;
+    while (ret.size() < transactions.size()) {
+      const size_t first = ret.size();
+      vector<evmc_result> results(transactions.size() - first);
+      const size_t executed = athena_execute_batch(
+          m_instance, &evmc::Host::get_interface(), EVMC_BYZANTIUM,
+          &messages[first], results.size(), results.data());
+      for (size_t i = 0; i < executed; i++)
+        ret.push_back(outcome(results[i]));
+      if (ret.size() < transactions.size()) {
+        stops.push_back(ret.size());
+        ret.push_back(execute(state, block, transactions, ret.size()));
+      }
+    }
+    return ret;
+  }
+
+private:
+  Outcome execute(State &state, Block &block,
+                  vector<Transaction> const &transactions, size_t i) {
+    const State before = state;
+    evmc_result result = m_instance->execute(
+        m_instance, &evmc::Host::get_interface(), block.hosts[i]->to_context(),
+        EVMC_BYZANTIUM, &block.messages[i], transactions[i].code.data(),
+        transactions[i].code.size());
+    if (result.status_code != EVMC_SUCCESS)
+      state = before;
+    return outcome(result);
+  }
+
+  evmc_vm *const m_instance;
+};
+
+// Checks that executing @transactions in batches matches executing them one
+// after another, and that the batches stopped at @expectedStops.
+void check(char const *name, vector<Transaction> const &transactions,
+           vector<size_t> const &expectedStops = {}) {
+  State initial;
+  initial.storage[contract][key(1)] = key(41);
+  initial.balances[coinbase] = key(7);
+
+  Athena athena;
+  State serialState = initial;
+  const vector<Outcome> serial = athena.serial(serialState, transactions);
+  State batchedState = initial;
+  vector<size_t> stops;
+  const vector<Outcome> batched =
+      athena.batched(batchedState, transactions, stops);
+
+  const int before = failures;
+  EXPECT(stops == expectedStops);
+  EXPECT(batched.size() == serial.size());
+  for (size_t i = 0; i < min(batched.size(), serial.size()); i++) {
+    EXPECT(batched[i].status == serial[i].status);
+    EXPECT(batched[i].gasLeft == serial[i].gasLeft);
+    EXPECT(batched[i].output == serial[i].output);
+  }
+  EXPECT(batchedState.storage == serialState.storage);
+  if (failures != before)
+    cerr << name << " failed\n";
+}
+
+} // namespace
+
+int main() {
+  // Independent messages, and messages that read what an earlier one stored
+  // and have to be executed again.
+  check("conflicts", {{increment, 1, 1, 2},
+                      {increment, 2, 2, 3},
+                      {increment, 3, 4, 5},
+                      {increment, 4, 3, 6},
+                      {increment, 5, 1, 7}});
+
+  // A reverted message leaves nothing behind for the ones after it.
+  check("revert", {{increment, 1, 1, 2},
+                   {failedIncrement, 2, 2, 8},
+                   {increment, 3, 8, 9},
+                   {failedIncrement, 4, 9, 10}});
+
+  // Every message sees the origin of its own transaction.
+  check("origin", {{storeOrigin, 1, 11, 0},
+                   {storeOrigin, 2, 12, 0},
+                   {storeOrigin, 3, 11, 0}});
+
+  // Calls and selfdestructs need the client, so the batch stops at them.
+  check("call", {{increment, 1, 1, 2}, {storeAndCall, 2, 2, 0},
+                 {increment, 3, 2, 3}},
+        {1});
+  check("selfdestruct", {{increment, 1, 1, 2},
+                         {storeAndDestruct, 2, 3, 0},
+                         {increment, 3, 3, 4}},
+        {1});
+
+  // The client pays the coinbase between messages, so the batch stops at a
+  // message that reads its balance.
+  check("coinbase", {{increment, 1, 1, 2},
+                     {storeCoinbaseBalance, 2, 13, 0},
+                     {increment, 3, 13, 14}},
+        {1});
+
+  if (failures)
+    cerr << failures << " failures\n";
+  return failures ? 1 : 0;
+}